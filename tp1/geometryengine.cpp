@@ -74,10 +74,12 @@ GeometryEngine::GeometryEngine()
     //initCubeGeometry();
     //initPlaneGeometry();
     initPlaneGeometry2();
+    initVertexArray();
 }
 
 GeometryEngine::~GeometryEngine()
 {
+    vao.destroy();
     arrayBuf.destroy();
     indexBuf.destroy();
 }
@@ -153,9 +155,13 @@ void GeometryEngine::initCubeGeometry()
 //! [1]
 }
 
-//! [2]
-void GeometryEngine::drawCubeGeometry(QOpenGLShaderProgram *program)
+void GeometryEngine::initVertexArray()
 {
+    // Buffers and attribute layout are recorded once, drawing only binds the VAO.
+    // Without VAO support the binder does nothing and the layout stays in the default state
+    vao.create();
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
+
     // Tell OpenGL which VBOs to use
     arrayBuf.bind();
     indexBuf.bind();
@@ -164,17 +170,21 @@ void GeometryEngine::drawCubeGeometry(QOpenGLShaderProgram *program)
     quintptr offset = 0;
 
     // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+    glEnableVertexAttribArray(positionLocation);
+    glVertexAttribPointer(positionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offset));
 
     // Offset for texture coordinate
     offset += sizeof(QVector3D);
 
     // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+    glEnableVertexAttribArray(texcoordLocation);
+    glVertexAttribPointer(texcoordLocation, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offset));
+}
+
+//! [2]
+void GeometryEngine::drawCubeGeometry()
+{
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
 
     // Draw cube geometry using indices from VBO 1
     glDrawElements(GL_TRIANGLE_STRIP, 34, GL_UNSIGNED_SHORT, 0);
@@ -299,53 +309,17 @@ void GeometryEngine::initPlaneGeometry2() {
 }
 
 
-void GeometryEngine::drawPlaneGeometry(QOpenGLShaderProgram *program)
+void GeometryEngine::drawPlaneGeometry()
 {
-    // Tell OpenGL which VBOs to use
-    arrayBuf.bind();
-    indexBuf.bind();
-
-    // Offset for position
-    quintptr offset = 0;
-
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
-
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
-
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
 
     // Draw cube geometry using indices from VBO 1
     glDrawElements(GL_TRIANGLE_STRIP, 29, GL_UNSIGNED_SHORT, 0);
 }
 
-void GeometryEngine::drawPlaneGeometry2(QOpenGLShaderProgram *program)
+void GeometryEngine::drawPlaneGeometry2()
 {
-    // Tell OpenGL which VBOs to use
-    arrayBuf.bind();
-    indexBuf.bind();
-
-    // Offset for position
-    quintptr offset = 0;
-
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
-
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
-
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
 
     // Draw cube geometry using indices from VBO 1
     glDrawElements(GL_TRIANGLE_STRIP, 1534, GL_UNSIGNED_SHORT, 0);
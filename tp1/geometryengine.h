@@ -54,16 +54,20 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
 
 class GeometryEngine : protected QOpenGLFunctions
 {
 public:
+    // Attribute locations, bound before the program is linked
+    static const int positionLocation = 0;
+    static const int texcoordLocation = 1;
     GeometryEngine();
     virtual ~GeometryEngine();
 
-    void drawCubeGeometry(QOpenGLShaderProgram *program);
-    void drawPlaneGeometry(QOpenGLShaderProgram *program);
-    void drawPlaneGeometry2(QOpenGLShaderProgram *program);
+    void drawCubeGeometry();
+    void drawPlaneGeometry();
+    void drawPlaneGeometry2();
 
 private:
     void initCubeGeometry();
@@ -71,8 +75,11 @@ private:
     void initPlaneGeometry2();
     float random(float max);
 
+    void initVertexArray();
+
     QOpenGLBuffer arrayBuf;
     QOpenGLBuffer indexBuf;
+    QOpenGLVertexArrayObject vao;
 };
 
 #endif // GEOMETRYENGINE_H
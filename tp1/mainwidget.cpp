@@ -157,6 +157,10 @@ void MainWidget::initShaders()
     if (!program.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/fshader.glsl"))
         close();
 
+    // Fixed attribute locations, recorded once in the geometry's vertex array
+    program.bindAttributeLocation("a_position", GeometryEngine::positionLocation);
+    program.bindAttributeLocation("a_texcoord", GeometryEngine::texcoordLocation);
+
     // Link shader pipeline
     if (!program.link())
         close();
@@ -223,9 +227,9 @@ void MainWidget::paintGL()
     program.setUniformValue("texture", 0);
 
     // Draw cube geometry
-    //geometries->drawCubeGeometry(&program);
-    //geometries->drawPlaneGeometry(&program);
-    geometries->drawPlaneGeometry2(&program);
+    //geometries->drawCubeGeometry();
+    //geometries->drawPlaneGeometry();
+    geometries->drawPlaneGeometry2();
 }
 
 void MainWidget::keyPressEvent(QKeyEvent *e) {
@@ -49,6 +49,7 @@
 ****************************************************************************/
 
 #include "geometryengine.h"
+#include "heightfield.h"
 
 #include <QVector2D>
 #include <QVector3D>
@@ -61,6 +62,13 @@ struct VertexData
     QVector2D texCoord;
 };
 
+// Heights of the plane : qGray / 255 * 1.5 + 1.5
+struct PlaneRange
+{
+    static constexpr float scale = 1.5f;
+    static constexpr float bias = 1.5f;
+};
+
 //! [0]
 GeometryEngine::GeometryEngine()
     : indexBuf(QOpenGLBuffer::IndexBuffer)
@@ -73,10 +81,12 @@ GeometryEngine::GeometryEngine()
 
     // Initializes cube geometry and transfers it to VBOs
     initPlaneGeometry();
+    initVertexArray();
 }
 
 GeometryEngine::~GeometryEngine()
 {
+    vao.destroy();
     arrayBuf.destroy();
     indexBuf.destroy();
 }
@@ -92,6 +102,7 @@ void GeometryEngine::initPlaneGeometry()
     }
 
     int height = heightMap.height(), width = heightMap.width();
+    const HeightField<quint8, RowMajorLayout, PlaneRange> heights(heightMap);
 
     int size = 64;
 
@@ -102,7 +113,7 @@ void GeometryEngine::initPlaneGeometry()
         for (int j=0;j<size;j++)
             {
                 // Vertex data for face 0
-                vertices[size*i+j] = { QVector3D(0.1*(i-size/2),0.1*(j-size/2), (float) qGray(heightMap.pixel(height / size * i, width / size * j)) / 255.0 * 1.5 + 1.5), QVector2D((float)i/size,(float)j/size)};
+                vertices[size*i+j] = { QVector3D(0.1*(i-size/2),0.1*(j-size/2), heights.at(height / size * i, width / size * j)), QVector2D((float)i/size,(float)j/size)};
                 // add height field eg (i-8)*(j-8)/256.0
         }
 
@@ -208,9 +219,13 @@ void GeometryEngine::initPlaneGeometry()
 //}
 
 
-//! [2]
-void GeometryEngine::drawPlaneGeometry(QOpenGLShaderProgram *program)
+void GeometryEngine::initVertexArray()
 {
+    // Buffers and attribute layout are recorded once, drawing only binds the VAO.
+    // Without VAO support the binder does nothing and the layout stays in the default state
+    vao.create();
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
+
     // Tell OpenGL which VBOs to use
     arrayBuf.bind();
     indexBuf.bind();
@@ -219,17 +234,21 @@ void GeometryEngine::drawPlaneGeometry(QOpenGLShaderProgram *program)
     quintptr offset = 0;
 
     // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+    glEnableVertexAttribArray(positionLocation);
+    glVertexAttribPointer(positionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offset));
 
     // Offset for texture coordinate
     offset += sizeof(QVector3D);
 
     // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+    glEnableVertexAttribArray(texcoordLocation);
+    glVertexAttribPointer(texcoordLocation, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offset));
+}
+
+//! [2]
+void GeometryEngine::drawPlaneGeometry()
+{
+    QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
 
     // Draw plane geometry using indices from VBO 1
     glDrawElements(GL_TRIANGLE_STRIP, taille_vertices, GL_UNSIGNED_SHORT, 0);
@@ -54,20 +54,27 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
 
 class GeometryEngine : protected QOpenGLFunctions
 {
 public:
+    // Attribute locations, bound before the program is linked
+    static const int positionLocation = 0;
+    static const int texcoordLocation = 1;
     GeometryEngine();
     virtual ~GeometryEngine();
 
-    void drawPlaneGeometry(QOpenGLShaderProgram *program);
+    void drawPlaneGeometry();
 
 private:
     void initPlaneGeometry();
 
+    void initVertexArray();
+
     QOpenGLBuffer arrayBuf;
     QOpenGLBuffer indexBuf;
+    QOpenGLVertexArrayObject vao;
 
     unsigned int taille_vertices;
 };
@@ -0,0 +1,63 @@
+#ifndef HEIGHTLAYOUT_H
+#define HEIGHTLAYOUT_H
+
+#include <cstddef>
+
+// Where sample (x, y) of a width x height grid lives in its storage
+
+// Rows one after the other, the layout of QImage
+struct RowMajorLayout
+{
+    RowMajorLayout(int width, int height) : width(width), height(height) {}
+
+    size_t size() const { return static_cast<size_t>(width) * height; }
+    size_t offset(int x, int y) const { return static_cast<size_t>(y) * width + x; }
+    // (x, y), (x + dx, y), (x, y + dy), (x + dx, y + dy) with dx and dy 0 or 1
+    void quad(int x, int y, int dx, int dy, size_t offsets[4]) const
+    {
+        offsets[0] = offset(x, y);
+        offsets[1] = offsets[0] + dx;
+        offsets[2] = offsets[0] + static_cast<size_t>(dy) * width;
+        offsets[3] = offsets[2] + dx;
+    }
+
+    int width;
+    int height;
+};
+
+// 8 x 8 tiles of rows, tiles themselves row by row. A tile of floats is four cache lines,
+// the corners of a quadtree leaf and their bilinear neighbours mostly fall in the same one
+struct TiledLayout
+{
+    static const int tileBits = 3;
+    static const int tileSize = 1 << tileBits;
+    static const int tileMask = tileSize - 1;
+
+    TiledLayout(int width, int height)
+        : width(width), height(height), tilesX((width + tileMask) >> tileBits), tilesY((height + tileMask) >> tileBits) {}
+
+    size_t size() const { return static_cast<size_t>(tilesX) * tilesY << (2 * tileBits); }
+    size_t offset(int x, int y) const
+    {
+        size_t tile = static_cast<size_t>(y >> tileBits) * tilesX + (x >> tileBits);
+        return tile << (2 * tileBits) | (y & tileMask) << tileBits | (x & tileMask);
+    }
+    void quad(int x, int y, int dx, int dy, size_t offsets[4]) const
+    {
+        // Inside the tile the neighbours are 1 and tileSize away, across it they start the next tile
+        size_t right = (x & tileMask) + dx < tileSize ? dx : tileSize * tileSize - tileMask;
+        size_t below = (y & tileMask) + dy < tileSize ? dy << tileBits
+                                                       : static_cast<size_t>(tilesX) * tileSize * tileSize - tileMask * tileSize;
+        offsets[0] = offset(x, y);
+        offsets[1] = offsets[0] + right;
+        offsets[2] = offsets[0] + below;
+        offsets[3] = offsets[2] + right;
+    }
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+};
+
+#endif // HEIGHTLAYOUT_H
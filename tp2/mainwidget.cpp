@@ -49,23 +49,33 @@
 ****************************************************************************/
 
 #include "mainwidget.h"
+#include "simulation.h"
 
 #include <QMouseEvent>
 
 #include <math.h>
 
-MainWidget::MainWidget(int fps, QWidget *parent) :
+MainWidget::MainWidget(double fps, QWidget *parent) :
     QOpenGLWidget(parent),
+    frameId(-1),
     geometries(0),
     texture(0),
     rotationAxis(0, 0, 1),
     angularSpeed(1),
-    fps(fps)
+    fps(fps),
+    timing(fps)
 {
+    simulationId = Simulation::instance()->add([this]() { stepRotation(); });
+    connect(this, &QOpenGLWidget::frameSwapped, [this]() { timing.frames.mark(); });
+    titleClock.start();
 }
 
 MainWidget::~MainWidget()
 {
+    Simulation::instance()->remove(simulationId);
+    if (frameId >= 0)
+        FrameScheduler::instance()->remove(frameId);
+
     // Make sure the context is current when deleting the texture
     // and the buffers.
     makeCurrent();
@@ -101,8 +111,27 @@ void MainWidget::mouseReleaseEvent(QMouseEvent *e)
 }
 //! [0]
 
+void MainWidget::tick()
+{
+    timing.ticks.mark();
+
+    // Requested vs achieved rate, live in the title bar
+    if (titleClock.elapsed() >= 1000)
+    {
+        setWindowTitle(timing.summary());
+        titleClock.restart();
+    }
+
+    // Catch up with the fixed timestep : the 1 fps and the 1000 fps windows
+    // turn at the same speed, they only sample it at different rates
+    Simulation::instance()->update();
+
+    // Request an update
+    update();
+}
+
 //! [1]
-void MainWidget::timerEvent(QTimerEvent *)
+void MainWidget::stepRotation()
 {
     // Decrease angular speed (friction)
     //angularSpeed *= 0.99;
@@ -111,12 +140,10 @@ void MainWidget::timerEvent(QTimerEvent *)
     //if (angularSpeed < 0.01) {
     //    angularSpeed = 0.0;
     //} else {
-        // Update rotation
+        // Update rotation, angularSpeed is in degrees per simulation step
     angularSpeed = speedChange;
+    previousRotation = rotation;
     rotation = QQuaternion::fromAxisAndAngle(rotationAxis, angularSpeed) * rotation;
-
-        // Request an update
-        update();
     //}
 }
 //! [1]
@@ -140,8 +167,8 @@ void MainWidget::initializeGL()
 
     geometries = new GeometryEngine;
 
-    // Use QBasicTimer because its faster than QTimer
-    timer.start((float)(1000.0 / fps), this);
+    // One scheduler drives every view, at the exact (possibly fractional) rate
+    frameId = FrameScheduler::instance()->add(fps, [this]() { tick(); });
 }
 
 //! [3]
@@ -155,6 +182,10 @@ void MainWidget::initShaders()
     if (!program.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/fshader.glsl"))
         close();
 
+    // Fixed attribute locations, recorded once in the geometry's vertex array
+    program.bindAttributeLocation("a_position", GeometryEngine::positionLocation);
+    program.bindAttributeLocation("a_texcoord", GeometryEngine::texcoordLocation);
+
     // Link shader pipeline
     if (!program.link())
         close();
@@ -223,7 +254,8 @@ void MainWidget::paintGL()
     // QVector3D up = QVector3D(-1,0,0);
     // matrix.lookAt(eye,center,up);
 
-    matrix.rotate(rotation);
+    // Render between the last two simulated states
+    matrix.rotate(QQuaternion::slerp(previousRotation, rotation, Simulation::instance()->alpha()));
 
 
     // Set modelview-projection matrix
@@ -233,7 +265,7 @@ void MainWidget::paintGL()
     program.setUniformValue("texture", 0);
 
     // Draw cube geometry
-    geometries->drawPlaneGeometry(&program);
+    geometries->drawPlaneGeometry();
 }
 
 void MainWidget::keyPressEvent(QKeyEvent *e) {
@@ -244,6 +276,9 @@ void MainWidget::keyPressEvent(QKeyEvent *e) {
     case Qt::Key_Down:
         speedChange -= 0.1;
         break;
+    case Qt::Key_F3:
+        timing.save("tp2-timing-" + std::to_string(static_cast<int>(fps)) + "fps");
+        break;
     case Qt::Key_Escape:
         std::exit(EXIT_SUCCESS);
     default:
@@ -52,15 +52,17 @@
 #define MAINWIDGET_H
 
 #include "geometryengine.h"
+#include "framescheduler.h"
+#include "frametiming.h"
 
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions>
 #include <QMatrix4x4>
 #include <QQuaternion>
 #include <QVector2D>
-#include <QBasicTimer>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
+#include <QElapsedTimer>
 
 class GeometryEngine;
 
@@ -71,24 +73,27 @@ class MainWidget : public QOpenGLWidget, protected QOpenGLFunctions
     Q_OBJECT
 
 public:
-    explicit MainWidget(int fps, QWidget *parent = 0);
+    explicit MainWidget(double fps, QWidget *parent = 0);
     ~MainWidget();
 
 protected:
     void mousePressEvent(QMouseEvent *e) override;
     void mouseReleaseEvent(QMouseEvent *e) override;
-    void timerEvent(QTimerEvent *e) override;
 
     void initializeGL() override;
     void resizeGL(int w, int h) override;
     void paintGL() override;
     void keyPressEvent(QKeyEvent *e);
+    // Called by the FrameScheduler at the requested rate
+    void tick();
+    void stepRotation();
 
     void initShaders();
     void initTextures();
 
 private:
-    QBasicTimer timer;
+    int frameId;
+    int simulationId;
     QOpenGLShaderProgram program;
     GeometryEngine *geometries;
 
@@ -100,7 +105,10 @@ private:
     QVector3D rotationAxis;
     qreal angularSpeed;
     QQuaternion rotation;
-    int fps;
+    QQuaternion previousRotation;
+    double fps;
+    FrameTiming timing;
+    QElapsedTimer titleClock;
 };
 
 #endif // MAINWIDGET_H
@@ -7,11 +7,19 @@ SOURCES += main.cpp
 
 SOURCES += \
     mainwidget.cpp \
-    geometryengine.cpp
+    geometryengine.cpp \
+    framescheduler.cpp \
+    simulation.cpp \
+    frametiming.cpp
 
 HEADERS += \
     mainwidget.h \
-    geometryengine.h
+    geometryengine.h \
+    framescheduler.h \
+    simulation.h \
+    frametiming.h \
+    heightfield.h \
+    heightlayout.h
 
 RESOURCES += \
     shaders.qrc \
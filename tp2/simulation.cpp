@@ -0,0 +1,66 @@
+#include "simulation.h"
+
+#include <algorithm>
+
+namespace
+{
+    const qint64 stepNs = 1000000000LL / Simulation::rate;
+}
+
+Simulation::Simulation()
+    : nextId(0), simulated(0), count(0)
+{
+    clock.start();
+}
+
+Simulation *Simulation::instance()
+{
+    static Simulation simulation;
+    return &simulation;
+}
+
+int Simulation::add(const Step &step)
+{
+    steps.push_back({ nextId, step });
+    return nextId++;
+}
+
+void Simulation::remove(int id)
+{
+    steps.erase(std::remove_if(steps.begin(), steps.end(), [id](const Entry &e) { return e.id == id; }), steps.end());
+}
+
+void Simulation::update()
+{
+    qint64 now = clock.nsecsElapsed();
+
+    // After a long stall, catch up a few steps and forget the rest
+    if (now - simulated > maxSteps * stepNs)
+        simulated = now - maxSteps * stepNs;
+
+    while (now - simulated >= stepNs)
+    {
+        // Copy : a step may add or remove entries
+        std::vector<Entry> current = steps;
+        for (const Entry &entry : current)
+            entry.step();
+        simulated += stepNs;
+        count++;
+    }
+}
+
+float Simulation::alpha() const
+{
+    qint64 ahead = clock.nsecsElapsed() - simulated;
+    return std::min(1.f, std::max(0.f, static_cast<float>(ahead) / stepNs));
+}
+
+float Simulation::dt()
+{
+    return 1.f / rate;
+}
+
+quint64 Simulation::stepCount() const
+{
+    return count;
+}
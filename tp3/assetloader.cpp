@@ -0,0 +1,100 @@
+#include "assetloader.h"
+#include "profiler.h"
+
+#include <chrono>
+
+namespace
+{
+    bool isPlainWhite(const QImage &image)
+    {
+        for (int y = 0; y < image.height(); y++)
+            for (int x = 0; x < image.width(); x++)
+                if (image.pixel(x, y) != qRgba(255, 255, 255, 255))
+                    return false;
+        return !image.isNull();
+    }
+
+    bool isFinished(const std::future<void> &task)
+    {
+        return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+}
+
+AssetLoader::AssetLoader()
+    : ready(false), textured(true)
+{
+}
+
+AssetLoader *AssetLoader::instance()
+{
+    static AssetLoader loader;
+    return &loader;
+}
+
+void AssetLoader::start()
+{
+    if (clock.isValid())
+        return;
+    clock.start();
+    terrain = std::async(std::launch::async, [this]() { loadTerrain(); });
+    texture = std::async(std::launch::async, [this]() { loadTexture(); });
+}
+
+void AssetLoader::loadTerrain()
+{
+    PROFILE_ZONE("AssetLoader::loadTerrain");
+    // The focus point doesn't move before this mesh is uploaded, see main()
+    if (!GeometryEngine::loadHeightMap())
+        return;
+    mesh = GeometryEngine::takeBakedMesh();
+    if (mesh.vertices.empty())
+    {
+        mesh = GeometryEngine::buildMesh(true);
+        GeometryEngine::bakeTerrain(mesh);
+    }
+}
+
+void AssetLoader::loadTexture()
+{
+    PROFILE_ZONE("AssetLoader::loadTexture");
+    // Load cube.png image
+    //image = QImage(":/heightmap-1.png");//.mirrored();
+    image = QImage(":/blanc.png");
+    textured = !isPlainWhite(image);
+}
+
+bool AssetLoader::isReady()
+{
+    if (ready || !clock.isValid())
+        return ready;
+    if (!isFinished(terrain) || !isFinished(texture))
+        return false;
+
+    // Synchronises with the workers, their results are visible from here on
+    terrain.get();
+    texture.get();
+    ready = true;
+    return true;
+}
+
+qint64 AssetLoader::elapsedMs() const
+{
+    return clock.isValid() ? clock.elapsed() : 0;
+}
+
+const QImage &AssetLoader::textureImage() const
+{
+    return image;
+}
+
+bool AssetLoader::isTextured() const
+{
+    return textured;
+}
+
+TerrainMesh AssetLoader::takeInitialMesh()
+{
+    TerrainMesh initial = std::move(mesh);
+    mesh = TerrainMesh();
+    return initial;
+}
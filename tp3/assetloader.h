@@ -0,0 +1,47 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include "geometryengine.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+
+#include <future>
+
+// Decodes the images and builds the first quadtree on worker threads from process start.
+// Windows draw a placeholder until isReady(), then take the results on the GUI thread
+class AssetLoader
+{
+public:
+    static AssetLoader *instance();
+
+    // Called once, before the windows are shown
+    void start();
+    // Never blocks : true once every task finished
+    bool isReady();
+    // Since start()
+    qint64 elapsedMs() const;
+
+    // Valid once ready
+    const QImage &textureImage() const;
+    // A plain white texture leaves the colour unchanged : the untextured variants skip the fetch
+    bool isTextured() const;
+    // The first caller gets the mesh, the others an empty one
+    TerrainMesh takeInitialMesh();
+
+private:
+    AssetLoader();
+
+    void loadTerrain();
+    void loadTexture();
+
+    QElapsedTimer clock;
+    std::future<void> terrain;
+    std::future<void> texture;
+    bool ready;
+    QImage image;
+    bool textured;
+    TerrainMesh mesh;
+};
+
+#endif // ASSETLOADER_H
@@ -2,7 +2,7 @@
 #include <QtMath>
 
 Camera::Camera(float x, float y, float z, float pitch, float yaw)
-    : position(QVector3D(x, y, z)), pitch(pitch), yaw(yaw)
+    : position(QVector3D(x, y, z)), pitch(pitch), yaw(yaw), revision(0)
 {
     mouseSensitivity = .1f;
     updateVectors();
@@ -16,6 +16,7 @@ float Camera::getX()
 void Camera::setY(float val)
 {
     position.setY(val);
+    revision++;
 }
 
 
@@ -27,6 +28,7 @@ float Camera::getY()
 void Camera::setZ(float val)
 {
     position.setZ(val);
+    revision++;
 }
 
 float Camera::getZ()
@@ -41,6 +43,39 @@ QVector3D Camera::getPosition(){
 void Camera::ApplyGravity(float gravityForce)
 {
     position.setY(position.y() - gravityForce);
+    revision++;
+}
+
+void Camera::ApplyGravity(float gravityForce, const QMatrix4x4 &terrain)
+{
+    // The terrain plane's normal in the world, the z axis of the model matrix
+    QVector3D terrainUp = terrain.mapVector(QVector3D(0.f, 0.f, 1.f)).normalized();
+    if (terrainUp.isNull())
+        return;
+    position -= terrainUp * gravityForce;
+    revision++;
+}
+
+void Camera::clampToGround(const QMatrix4x4 &terrain, float clearance)
+{
+    bool invertible = false;
+    QMatrix4x4 toTerrain = terrain.inverted(&invertible);
+    if (!invertible || !TerrainQuery::isReady())
+        return;
+    QVector3D local = toTerrain.map(position);
+    if (!TerrainQuery::contains(local.x(), local.y()))
+        return;
+    float ground = TerrainQuery::heightAt(local.x(), local.y()) + clearance;
+    if (local.z() >= ground)
+        return;
+    local.setZ(ground);
+    position = terrain.map(local);
+    revision++;
+}
+
+unsigned int Camera::getRevision() const
+{
+    return revision;
 }
 
 QMatrix4x4 Camera::getViewMatrix()
@@ -50,6 +85,15 @@ QMatrix4x4 Camera::getViewMatrix()
     return viewMatrix;
 }
 
+Ray Camera::rayThrough(float x, float y, const QMatrix4x4 &projection)
+{
+    // Unprojected on the near and far planes
+    QMatrix4x4 inverse = (projection * getViewMatrix()).inverted();
+    QVector3D nearPoint = inverse.map(QVector3D(x, y, -1.f));
+    QVector3D farPoint = inverse.map(QVector3D(x, y, 1.f));
+    return { nearPoint, (farPoint - nearPoint).normalized() };
+}
+
 void Camera::processMovement(Direction dir, float dist)
 {
     switch (dir)
@@ -73,6 +117,7 @@ void Camera::processMovement(Direction dir, float dist)
         position -= up * dist;
         break;
     }
+    revision++;
 }
 
 void Camera::processMouseMovement(float offset_x, float offset_y)
@@ -84,6 +129,7 @@ void Camera::processMouseMovement(float offset_x, float offset_y)
     if (pitch < -89.f) pitch = -89.f;
     if (pitch > 89.f) pitch = 89.f;
     updateVectors();
+    revision++;
 }
 
 void Camera::updateVectors()
@@ -6,6 +6,8 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 
+#include "terrainquery.h"
+
 enum Direction {
     FORWARD,
     BACKWARD,
@@ -20,6 +22,8 @@ class Camera
 public:
     Camera(float x, float y, float z, float pitch = 0.f, float yaw = -90.f);
     QMatrix4x4 getViewMatrix();
+    // From the eye through a point of the viewport, x and y in [-1, 1] from the bottom left
+    Ray rayThrough(float x, float y, const QMatrix4x4 &projection);
     void processMovement(Direction dir, float dist);
     void processMouseMovement(float offset_x, float offset_y);
     float getX();
@@ -29,6 +33,13 @@ public:
     float getZ();
     QVector3D getPosition();
     void ApplyGravity(float gravityForce);
+    // Pulls the camera down the up axis of the terrain, the axis clampToGround() lifts along
+    void ApplyGravity(float gravityForce, const QMatrix4x4 &terrain);
+    // Lifts the camera to clearance above the ground along the up axis of the terrain, if it
+    // is over it. terrain maps the terrain plane to the world, see MainWidget::modelMatrix()
+    void clampToGround(const QMatrix4x4 &terrain, float clearance);
+    // Incremented on every change, lets the views know they have to repaint
+    unsigned int getRevision() const;
 
 protected:
     void updateVectors();
@@ -41,6 +52,7 @@ private:
     QVector3D right;
     QVector3D up;
     float mouseSensitivity;
+    unsigned int revision;
 
 };
 
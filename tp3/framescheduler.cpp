@@ -0,0 +1,189 @@
+#include "framescheduler.h"
+
+#include <QCoreApplication>
+#include <QTimerEvent>
+
+#include <algorithm>
+#include <cmath>
+
+FrameScheduler *FrameScheduler::scheduler = nullptr;
+
+FrameScheduler::FrameScheduler(QObject *parent)
+    : QObject(parent), nextId(0), refreshRate(0.0), frames(0), tolerance(std::chrono::microseconds(500))
+{
+}
+
+FrameScheduler *FrameScheduler::instance()
+{
+    // Owned by the application so the timer dies with the event loop
+    if (scheduler == nullptr)
+        scheduler = new FrameScheduler(QCoreApplication::instance());
+    return scheduler;
+}
+
+FrameScheduler::Clock::duration FrameScheduler::periodFor(double fps) const
+{
+    double seconds = 1.0 / std::max(fps, 1e-3);
+    if (refreshRate > 0.0)
+    {
+        // Never faster than the display, and a whole number of refreshes
+        double frames = std::max(1.0, std::round(seconds * refreshRate));
+        seconds = frames / refreshRate;
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+int FrameScheduler::add(double fps, const Callback &tick)
+{
+    View view;
+    view.id = nextId++;
+    view.fps = fps;
+    view.period = periodFor(fps);
+    view.next = Clock::now() + view.period;
+    view.tick = tick;
+    view.paused = false;
+    view.frames = view.skipped = 0;
+    view.firstFrame = Clock::now();
+    views.push_back(view);
+    schedule();
+    return view.id;
+}
+
+void FrameScheduler::remove(int id)
+{
+    views.erase(std::remove_if(views.begin(), views.end(), [id](const View &v) { return v.id == id; }), views.end());
+    schedule();
+}
+
+void FrameScheduler::setPaused(int id, bool paused)
+{
+    View *view = find(id);
+    if (view == nullptr || view->paused == paused)
+        return;
+    view->paused = paused;
+    if (!paused)
+        view->next = Clock::now();
+    schedule();
+}
+
+void FrameScheduler::setRate(int id, double fps)
+{
+    View *view = find(id);
+    if (view == nullptr)
+        return;
+    view->fps = fps;
+    view->period = periodFor(fps);
+    view->next = Clock::now() + view->period;
+    view->frames = view->skipped = 0;
+    view->firstFrame = Clock::now();
+    schedule();
+}
+
+void FrameScheduler::setVsync(double refreshRate)
+{
+    this->refreshRate = refreshRate;
+    for (View &view : views)
+        view.period = periodFor(view.fps);
+    schedule();
+}
+
+double FrameScheduler::achievedRate(int id) const
+{
+    const View *view = find(id);
+    if (view == nullptr || view->frames < 2)
+        return 0.0;
+    double seconds = std::chrono::duration<double>(Clock::now() - view->firstFrame).count();
+    return seconds > 0.0 ? (view->frames - 1) / seconds : 0.0;
+}
+
+quint64 FrameScheduler::skippedFrames(int id) const
+{
+    const View *view = find(id);
+    return view == nullptr ? 0 : view->skipped;
+}
+
+FrameScheduler::View *FrameScheduler::find(int id)
+{
+    for (View &view : views)
+        if (view.id == id) return &view;
+    return nullptr;
+}
+
+const FrameScheduler::View *FrameScheduler::find(int id) const
+{
+    for (const View &view : views)
+        if (view.id == id) return &view;
+    return nullptr;
+}
+
+quint64 FrameScheduler::frame() const
+{
+    return frames;
+}
+
+void FrameScheduler::timerEvent(QTimerEvent *e)
+{
+    if (e->timerId() != timer.timerId())
+    {
+        QObject::timerEvent(e);
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+
+    // Collect the ids first : a tick may add or remove views
+    std::vector<int> due;
+    for (View &view : views)
+    {
+        if (view.paused || view.next > now + tolerance)
+            continue;
+        due.push_back(view.id);
+
+        if (view.frames == 0)
+            view.firstFrame = now;
+        view.frames++;
+
+        // Keep the phase, drop the frames we are too late for
+        view.next += view.period;
+        if (view.next <= now)
+        {
+            Clock::duration late = now - view.next;
+            quint64 missed = static_cast<quint64>(late / view.period) + 1;
+            view.skipped += missed;
+            view.next += view.period * static_cast<Clock::rep>(missed);
+        }
+    }
+
+    if (!due.empty())
+        frames++;
+    for (int id : due)
+    {
+        View *view = find(id);
+        if (view != nullptr)
+            view->tick();
+    }
+
+    schedule();
+}
+
+void FrameScheduler::schedule()
+{
+    Clock::time_point next = Clock::time_point::max();
+    for (const View &view : views)
+        if (!view.paused) next = std::min(next, view.next);
+
+    if (next == Clock::time_point::max())
+    {
+        timer.stop();
+        return;
+    }
+
+    // Qt timers count whole milliseconds : wake up early rather than late,
+    // the tolerance above absorbs the remainder. Within it the view is due now;
+    // short of it but under a millisecond, a 0 ms timer would only spin until then
+    Clock::duration remaining = next - Clock::now();
+    qint64 ms = 0;
+    if (remaining > tolerance)
+        ms = std::max<qint64>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count(), 1);
+    timer.start(static_cast<int>(ms), Qt::PreciseTimer, this);
+}
@@ -0,0 +1,69 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QBasicTimer>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+// Drives every registered view from one precise timer on a steady clock.
+// Views due within the same tick are coalesced, late views skip the frames
+// they missed instead of queueing them.
+class FrameScheduler : public QObject
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void()> Callback;
+
+    static FrameScheduler *instance();
+
+    // Fractional rates are kept exact, 60 fps is 16.667 ms and not 16 ms
+    int add(double fps, const Callback &tick);
+    void remove(int id);
+    void setPaused(int id, bool paused);
+    void setRate(int id, double fps);
+    double achievedRate(int id) const;
+    quint64 skippedFrames(int id) const;
+
+    // Snap every period to a whole number of refresh intervals, 0 disables it
+    void setVsync(double refreshRate);
+
+    // Timer events that ticked views so far : views ticked together share a frame
+    quint64 frame() const;
+
+protected:
+    void timerEvent(QTimerEvent *e) override;
+
+private:
+    struct View
+    {
+        int id;
+        double fps;
+        Clock::duration period;
+        Clock::time_point next;
+        Callback tick;
+        bool paused;
+        quint64 frames;
+        quint64 skipped;
+        Clock::time_point firstFrame;
+    };
+
+    explicit FrameScheduler(QObject *parent);
+    View *find(int id);
+    const View *find(int id) const;
+    Clock::duration periodFor(double fps) const;
+    void schedule();
+
+    static FrameScheduler *scheduler;
+    std::vector<View> views;
+    QBasicTimer timer;
+    int nextId;
+    double refreshRate;
+    quint64 frames;
+    // Views whose deadline falls within this window are ticked together
+    const Clock::duration tolerance;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,266 @@
+#include "framestats.h"
+
+#include <QOpenGLContext>
+#include <QPolygonF>
+#include <QPen>
+
+FrameStats::FrameStats(QOpenGLFunctions_4_5_Core *gl)
+    : collectPrimitives(true), collectPipelineStats(false), gl(gl), frame(0),
+      activeStage(GpuStage::Clear), stageActive(false), lastFrameStart(-1), historyIndex(0)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    hasPipelineStats = context != nullptr && context->hasExtension("GL_ARB_pipeline_statistics_query");
+
+    for (QuerySet &set : sets)
+    {
+        gl->glGenQueries(stageCount, set.time);
+        gl->glGenQueries(1, &set.primitives);
+        gl->glGenQueries(1, &set.vertexInvocations);
+        gl->glGenQueries(1, &set.fragmentInvocations);
+        set.primitivesIssued = set.pipelineIssued = set.pending = false;
+        for (bool &issued : set.issued) issued = false;
+    }
+    clock.start();
+}
+
+FrameStats::~FrameStats()
+{
+    for (QuerySet &set : sets)
+    {
+        gl->glDeleteQueries(stageCount, set.time);
+        gl->glDeleteQueries(1, &set.primitives);
+        gl->glDeleteQueries(1, &set.vertexInvocations);
+        gl->glDeleteQueries(1, &set.fragmentInvocations);
+    }
+}
+
+void FrameStats::beginFrame()
+{
+    // Results of frame N - 2 should be ready by now, read them without stalling
+    QuerySet &old = sets[(frame + 1) % latency];
+    if (old.pending && readBack(old))
+        old.pending = false;
+
+    QuerySet &set = sets[frame % latency];
+    // A set still pending here never became available : drop it rather than wait
+    set.pending = false;
+    set.primitivesIssued = set.pipelineIssued = false;
+    for (bool &issued : set.issued) issued = false;
+    set.sample = FrameSample();
+    set.sample.frame = frame;
+
+    qint64 now = clock.nsecsElapsed();
+    if (lastFrameStart >= 0)
+        set.sample.frameMs = (now - lastFrameStart) / 1e6f;
+    lastFrameStart = now;
+}
+
+void FrameStats::beginStage(GpuStage stage)
+{
+    // GL_TIME_ELAPSED queries can't be nested
+    if (stageActive)
+        endStage();
+
+    QuerySet &set = sets[frame % latency];
+    int i = static_cast<int>(stage);
+    gl->glBeginQuery(GL_TIME_ELAPSED, set.time[i]);
+    set.issued[i] = true;
+    activeStage = stage;
+    stageActive = true;
+
+    if (stage == GpuStage::Terrain)
+        beginCounters(set);
+}
+
+void FrameStats::endStage()
+{
+    if (!stageActive)
+        return;
+
+    QuerySet &set = sets[frame % latency];
+    gl->glEndQuery(GL_TIME_ELAPSED);
+    if (activeStage == GpuStage::Terrain)
+        endCounters(set);
+    stageActive = false;
+}
+
+void FrameStats::beginCounters(QuerySet &set)
+{
+    if (collectPrimitives)
+    {
+        gl->glBeginQuery(GL_PRIMITIVES_GENERATED, set.primitives);
+        set.primitivesIssued = true;
+    }
+    if (collectPipelineStats && hasPipelineStats)
+    {
+        gl->glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, set.vertexInvocations);
+        gl->glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, set.fragmentInvocations);
+        set.pipelineIssued = true;
+    }
+}
+
+void FrameStats::endCounters(QuerySet &set)
+{
+    if (set.primitivesIssued)
+        gl->glEndQuery(GL_PRIMITIVES_GENERATED);
+    if (set.pipelineIssued)
+    {
+        gl->glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+        gl->glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    }
+}
+
+void FrameStats::addCulled(int nodes, int triangles)
+{
+    FrameSample &sample = sets[frame % latency].sample;
+    sample.culledNodes += nodes;
+    sample.culledTriangles += triangles;
+}
+
+void FrameStats::setLod(int level, int depth, float maxDist, float costMs, float targetMs)
+{
+    FrameSample &sample = sets[frame % latency].sample;
+    sample.lodLevel = level;
+    sample.lodDepth = depth;
+    sample.lodMaxDist = maxDist;
+    sample.lodCostMs = costMs;
+    sample.lodTargetMs = targetMs;
+}
+
+void FrameStats::setPrefetch(int neededChunks, int notReadyChunks)
+{
+    FrameSample &sample = sets[frame % latency].sample;
+    sample.neededChunks = neededChunks;
+    sample.notReadyChunks = notReadyChunks;
+}
+
+void FrameStats::endFrame(float cpuBuildMs, int triangles, int nodes, qint64 uploadBytes)
+{
+    if (stageActive)
+        endStage();
+
+    QuerySet &set = sets[frame % latency];
+    set.sample.cpuBuildMs = cpuBuildMs;
+    set.sample.triangles = triangles;
+    set.sample.nodes = nodes;
+    set.sample.uploadBytes = uploadBytes;
+    set.pending = true;
+    frame++;
+}
+
+bool FrameStats::readBack(QuerySet &set)
+{
+    GLuint available = GL_TRUE;
+    for (int i = 0; i < stageCount; i++)
+    {
+        if (!set.issued[i]) continue;
+        GLuint ready = GL_FALSE;
+        gl->glGetQueryObjectuiv(set.time[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+        available = available && ready;
+    }
+    if (!available)
+        return false;
+
+    FrameSample &sample = set.sample;
+    for (int i = 0; i < stageCount; i++)
+    {
+        GLuint64 ns = 0;
+        if (set.issued[i])
+            gl->glGetQueryObjectui64v(set.time[i], GL_QUERY_RESULT, &ns);
+        sample.gpuMs[i] = ns / 1e6f;
+        sample.gpuTotalMs += sample.gpuMs[i];
+    }
+    if (set.primitivesIssued)
+    {
+        GLuint64 count = 0;
+        gl->glGetQueryObjectui64v(set.primitives, GL_QUERY_RESULT, &count);
+        sample.primitives = count;
+    }
+    if (set.pipelineIssued)
+    {
+        GLuint64 count = 0;
+        gl->glGetQueryObjectui64v(set.vertexInvocations, GL_QUERY_RESULT, &count);
+        sample.vertexInvocations = count;
+        gl->glGetQueryObjectui64v(set.fragmentInvocations, GL_QUERY_RESULT, &count);
+        sample.fragmentInvocations = count;
+    }
+
+    historyIndex = (historyIndex + 1) % historySize;
+    history[historyIndex] = sample;
+    return true;
+}
+
+const FrameSample &FrameStats::last() const
+{
+    return history[historyIndex];
+}
+
+void FrameStats::drawOverlay(QPainter &painter, const QRect &area) const
+{
+    const FrameSample &s = last();
+    const int lineHeight = 14;
+    const int graphHeight = 60;
+    int y = area.top() + lineHeight;
+
+    painter.fillRect(area, QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(area.left() + 6, y, QString("frame %1 ms  (%2 fps)")
+                     .arg(static_cast<double>(s.frameMs), 0, 'f', 2)
+                     .arg(s.frameMs > 0.f ? 1000.0 / static_cast<double>(s.frameMs) : 0.0, 0, 'f', 1));
+    y += lineHeight;
+    painter.drawText(area.left() + 6, y, QString("cpu build %1 ms").arg(static_cast<double>(s.cpuBuildMs), 0, 'f', 2));
+    y += lineHeight;
+    painter.setPen(Qt::green);
+    painter.drawText(area.left() + 6, y, QString("gpu %1 ms  (clear %2, lod %3, terrain %4)")
+                     .arg(static_cast<double>(s.gpuTotalMs), 0, 'f', 2)
+                     .arg(static_cast<double>(s.gpuMs[static_cast<int>(GpuStage::Clear)]), 0, 'f', 2)
+                     .arg(static_cast<double>(s.gpuMs[static_cast<int>(GpuStage::LodBuild)]), 0, 'f', 2)
+                     .arg(static_cast<double>(s.gpuMs[static_cast<int>(GpuStage::Terrain)]), 0, 'f', 2));
+    y += lineHeight;
+    painter.setPen(Qt::white);
+    painter.drawText(area.left() + 6, y, QString("triangles %1  nodes %2  upload %3 KiB")
+                     .arg(s.triangles).arg(s.nodes).arg(s.uploadBytes / 1024));
+    y += lineHeight;
+    painter.drawText(area.left() + 6, y, QString("culled %1 nodes  %2 triangles").arg(s.culledNodes).arg(s.culledTriangles));
+    y += lineHeight;
+    painter.drawText(area.left() + 6, y, QString("lod level %1  depth %2  maxDist %3  (%4 / %5 ms)")
+                     .arg(s.lodLevel).arg(s.lodDepth).arg(static_cast<double>(s.lodMaxDist), 0, 'f', 2)
+                     .arg(static_cast<double>(s.lodCostMs), 0, 'f', 1).arg(static_cast<double>(s.lodTargetMs), 0, 'f', 1));
+    y += lineHeight;
+    painter.drawText(area.left() + 6, y, QString("needed %1 chunks  not ready %2").arg(s.neededChunks).arg(s.notReadyChunks));
+    y += lineHeight;
+    if (collectPrimitives)
+    {
+        painter.drawText(area.left() + 6, y, QString("primitives %1").arg(static_cast<unsigned long long>(s.primitives)));
+        y += lineHeight;
+    }
+    if (collectPipelineStats && hasPipelineStats)
+    {
+        painter.drawText(area.left() + 6, y, QString("vs %1  fs %2")
+                         .arg(static_cast<unsigned long long>(s.vertexInvocations))
+                         .arg(static_cast<unsigned long long>(s.fragmentInvocations)));
+        y += lineHeight;
+    }
+
+    // Rolling graph, 33 ms at the top, reference line at 16.7 ms
+    QRect graph(area.left() + 6, y, area.width() - 12, graphHeight);
+    if (graph.bottom() > area.bottom())
+        return;
+    const float scale = graphHeight / 33.3f;
+    const float step = static_cast<float>(graph.width()) / (historySize - 1);
+    painter.setPen(QColor(255, 255, 255, 80));
+    painter.drawLine(graph.left(), graph.bottom() - static_cast<int>(16.7f * scale), graph.right(), graph.bottom() - static_cast<int>(16.7f * scale));
+
+    QPolygonF cpu, gpu;
+    for (int i = 0; i < historySize; i++)
+    {
+        const FrameSample &h = history[(historyIndex + 1 + i) % historySize];
+        float x = graph.left() + i * step;
+        cpu << QPointF(static_cast<double>(x), static_cast<double>(graph.bottom() - qMin(h.frameMs * scale, static_cast<float>(graphHeight))));
+        gpu << QPointF(static_cast<double>(x), static_cast<double>(graph.bottom() - qMin(h.gpuTotalMs * scale, static_cast<float>(graphHeight))));
+    }
+    painter.setPen(Qt::white);
+    painter.drawPolyline(cpu);
+    painter.setPen(Qt::green);
+    painter.drawPolyline(gpu);
+}
@@ -0,0 +1,95 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QRect>
+
+// Render stages timed on the GPU with GL_TIME_ELAPSED queries
+enum class GpuStage { Clear = 0, LodBuild = 1, Terrain = 2, Count = 3 };
+
+struct FrameSample
+{
+    int frame = -1;                 // FrameStats frame counter, tells samples apart
+    float frameMs = 0.f;            // interval between two paintGL
+    float cpuBuildMs = 0.f;         // CPU time spent building the quadtree
+    float gpuMs[static_cast<int>(GpuStage::Count)] = {};
+    float gpuTotalMs = 0.f;
+    quint64 primitives = 0;         // GL_PRIMITIVES_GENERATED
+    quint64 vertexInvocations = 0;  // ARB_pipeline_statistics_query
+    quint64 fragmentInvocations = 0;
+    int triangles = 0;
+    int nodes = 0;
+    int culledNodes = 0;            // terrain chunks skipped by the HorizonCuller, all views
+    int culledTriangles = 0;
+    int lodLevel = 0;               // LodController decision for this frame
+    int lodDepth = 0;
+    float lodMaxDist = 0.f;
+    float lodCostMs = 0.f;          // terrain time per target frame it was based on
+    float lodTargetMs = 0.f;
+    int neededChunks = 0;           // chunks the LodRefiner moved to their target
+    int notReadyChunks = 0;         // of them, not built ahead by its prefetch
+    qint64 uploadBytes = 0;
+};
+
+class FrameStats
+{
+public:
+    // Query sets in flight : the set issued at frame N is read back at frame N + 2
+    static const int latency = 3;
+    static const int historySize = 120;
+
+    // The context owning gl must be current for the constructor and destructor
+    explicit FrameStats(QOpenGLFunctions_4_5_Core *gl);
+    ~FrameStats();
+
+    void beginFrame();
+    void beginStage(GpuStage stage);
+    void endStage();
+    // Once per view drawn with culling
+    void addCulled(int nodes, int triangles);
+    void setLod(int level, int depth, float maxDist, float costMs, float targetMs);
+    void setPrefetch(int neededChunks, int notReadyChunks);
+    void endFrame(float cpuBuildMs, int triangles, int nodes, qint64 uploadBytes);
+
+    // Latest frame whose GPU results are known
+    const FrameSample &last() const;
+    void drawOverlay(QPainter &painter, const QRect &area) const;
+
+    bool collectPrimitives;
+    bool collectPipelineStats;
+
+private:
+    static const int stageCount = static_cast<int>(GpuStage::Count);
+
+    struct QuerySet
+    {
+        GLuint time[stageCount];
+        GLuint primitives;
+        GLuint vertexInvocations;
+        GLuint fragmentInvocations;
+        bool issued[stageCount];
+        bool primitivesIssued;
+        bool pipelineIssued;
+        bool pending;
+        FrameSample sample;
+    };
+
+    bool readBack(QuerySet &set);
+    void beginCounters(QuerySet &set);
+    void endCounters(QuerySet &set);
+
+    QOpenGLFunctions_4_5_Core *gl;
+    QuerySet sets[latency];
+    int frame;
+    GpuStage activeStage;
+    bool stageActive;
+    bool hasPipelineStats;
+    QElapsedTimer clock;
+    qint64 lastFrameStart;
+    FrameSample history[historySize];
+    int historyIndex;
+};
+
+#endif // FRAMESTATS_H
@@ -0,0 +1,236 @@
+#include "frametiming.h"
+
+#include <QtAlgorithms>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+TimingHistogram::TimingHistogram()
+{
+    reset();
+}
+
+void TimingHistogram::reset()
+{
+    std::fill(buckets, buckets + bucketCount, 0);
+    total = 0;
+    maximum = 0;
+    sum = 0.0;
+}
+
+int TimingHistogram::bucketOf(qint64 us)
+{
+    if (us < linear)
+        return static_cast<int>(std::max<qint64>(us, 0));
+
+    // Position of the highest bit, >= 6 here
+    int e = 63 - static_cast<int>(qCountLeadingZeroBits(static_cast<quint64>(us)));
+    int shift = e - 5;
+    int sub = static_cast<int>(us >> shift) - subBuckets;
+    return std::min(linear + (e - 6) * subBuckets + sub, bucketCount - 1);
+}
+
+qint64 TimingHistogram::bucketLow(int bucket)
+{
+    if (bucket < linear)
+        return bucket;
+    int e = (bucket - linear) / subBuckets + 6;
+    int sub = (bucket - linear) % subBuckets + subBuckets;
+    return static_cast<qint64>(sub) << (e - 5);
+}
+
+qint64 TimingHistogram::bucketHigh(int bucket)
+{
+    if (bucket < linear)
+        return bucket;
+    return bucketLow(bucket + 1) - 1;
+}
+
+void TimingHistogram::record(qint64 us)
+{
+    buckets[bucketOf(us)]++;
+    total++;
+    maximum = std::max(maximum, us);
+    sum += us;
+}
+
+quint64 TimingHistogram::count() const
+{
+    return total;
+}
+
+qint64 TimingHistogram::max() const
+{
+    return maximum;
+}
+
+double TimingHistogram::mean() const
+{
+    return total > 0 ? sum / total : 0.0;
+}
+
+quint64 TimingHistogram::bucket(int i) const
+{
+    return buckets[i];
+}
+
+qint64 TimingHistogram::percentile(double p) const
+{
+    if (total == 0)
+        return 0;
+    quint64 rank = static_cast<quint64>(std::ceil(p / 100.0 * total));
+    rank = std::max<quint64>(rank, 1);
+    quint64 seen = 0;
+    for (int i = 0; i < bucketCount; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(bucketHigh(i), maximum);
+    }
+    return maximum;
+}
+
+TimingStream::TimingStream(const char *name)
+    : name(name), requested(0.0)
+{
+    reset();
+}
+
+void TimingStream::setRequestedRate(double fps)
+{
+    requested = fps;
+    reset();
+}
+
+void TimingStream::reset()
+{
+    clock.start();
+    last = first = -1;
+    missed = 0;
+    intervalHistogram.reset();
+    jitterHistogram.reset();
+}
+
+void TimingStream::mark()
+{
+    qint64 now = clock.nsecsElapsed() / 1000;
+    if (last >= 0)
+    {
+        qint64 interval = now - last;
+        intervalHistogram.record(interval);
+        if (requested > 0.0)
+        {
+            qint64 period = static_cast<qint64>(1e6 / requested);
+            jitterHistogram.record(std::abs(interval - period));
+            // Late by more than half a period : the event slipped to the next slot
+            if (interval > period + period / 2)
+                missed++;
+        }
+    }
+    else
+        first = now;
+    last = now;
+}
+
+double TimingStream::requestedRate() const
+{
+    return requested;
+}
+
+double TimingStream::achievedRate() const
+{
+    if (last <= first || intervalHistogram.count() == 0)
+        return 0.0;
+    return intervalHistogram.count() * 1e6 / (last - first);
+}
+
+quint64 TimingStream::missedDeadlines() const
+{
+    return missed;
+}
+
+const TimingHistogram &TimingStream::intervals() const
+{
+    return intervalHistogram;
+}
+
+const TimingHistogram &TimingStream::jitter() const
+{
+    return jitterHistogram;
+}
+
+QString TimingStream::summary() const
+{
+    return QString("%1 %2/%3 fps, jitter p50 %4 p99 %5 max %6 ms, missed %7")
+            .arg(name)
+            .arg(achievedRate(), 0, 'f', 1)
+            .arg(requested, 0, 'f', 1)
+            .arg(jitterHistogram.percentile(50) / 1000.0, 0, 'f', 2)
+            .arg(jitterHistogram.percentile(99) / 1000.0, 0, 'f', 2)
+            .arg(jitterHistogram.max() / 1000.0, 0, 'f', 2)
+            .arg(static_cast<unsigned long long>(missed));
+}
+
+std::string TimingStream::toJson() const
+{
+    std::ostringstream out;
+    out << "{\"name\":\"" << name << "\",\"requestedFps\":" << requested << ",\"achievedFps\":" << achievedRate()
+        << ",\"count\":" << intervalHistogram.count() << ",\"missedDeadlines\":" << missed
+        << ",\"intervalUs\":{\"mean\":" << intervalHistogram.mean() << ",\"p50\":" << intervalHistogram.percentile(50)
+        << ",\"p99\":" << intervalHistogram.percentile(99) << ",\"max\":" << intervalHistogram.max() << "}"
+        << ",\"jitterUs\":{\"p50\":" << jitterHistogram.percentile(50) << ",\"p99\":" << jitterHistogram.percentile(99)
+        << ",\"max\":" << jitterHistogram.max() << "},\"buckets\":[";
+    bool first = true;
+    for (int i = 0; i < TimingHistogram::bucketCount; i++)
+    {
+        if (intervalHistogram.bucket(i) == 0) continue;
+        out << (first ? "" : ",") << "[" << TimingHistogram::bucketLow(i) << "," << TimingHistogram::bucketHigh(i)
+            << "," << intervalHistogram.bucket(i) << "]";
+        first = false;
+    }
+    out << "]}";
+    return out.str();
+}
+
+std::string TimingStream::toCsv() const
+{
+    // One line per non empty interval bucket
+    std::ostringstream out;
+    for (int i = 0; i < TimingHistogram::bucketCount; i++)
+    {
+        if (intervalHistogram.bucket(i) == 0) continue;
+        out << name << "," << TimingHistogram::bucketLow(i) << "," << TimingHistogram::bucketHigh(i)
+            << "," << intervalHistogram.bucket(i) << "\n";
+    }
+    return out.str();
+}
+
+FrameTiming::FrameTiming(double fps)
+    : ticks("ticks"), frames("frames")
+{
+    ticks.setRequestedRate(fps);
+    frames.setRequestedRate(fps);
+}
+
+QString FrameTiming::summary() const
+{
+    return ticks.summary() + " | " + frames.summary();
+}
+
+bool FrameTiming::save(const std::string &prefix) const
+{
+    std::ofstream csv(prefix + ".csv");
+    std::ofstream json(prefix + ".json");
+    if (!csv || !json) {
+        std::cerr << "Error : can't write " << prefix << std::endl;
+        return false;
+    }
+
+    csv << "stream,low_us,high_us,count\n" << ticks.toCsv() << frames.toCsv();
+    json << "{\"streams\":[" << ticks.toJson() << "," << frames.toJson() << "]}\n";
+    std::cerr << "Frame timing written to " << prefix << ".csv/.json" << std::endl;
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef FRAMETIMING_H
+#define FRAMETIMING_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <string>
+
+// Log-linear histogram of durations in µs (HDR style) : exact below 64 µs,
+// then 32 buckets per power of two, about 3% relative precision up to hours
+class TimingHistogram
+{
+public:
+    static const int linear = 64;
+    static const int subBuckets = 32;
+    static const int magnitudes = 36;
+    static const int bucketCount = linear + magnitudes * subBuckets;
+
+    TimingHistogram();
+    void record(qint64 us);
+    void reset();
+
+    quint64 count() const;
+    qint64 max() const;
+    double mean() const;
+    // Upper bound of the bucket holding the p-th percentile, p in [0, 100]
+    qint64 percentile(double p) const;
+
+    static int bucketOf(qint64 us);
+    static qint64 bucketLow(int bucket);
+    static qint64 bucketHigh(int bucket);
+    quint64 bucket(int i) const;
+
+private:
+    quint64 buckets[bucketCount];
+    quint64 total;
+    qint64 maximum;
+    double sum;
+};
+
+// Requested vs achieved timing of one stream of events (timer ticks or presented frames)
+class TimingStream
+{
+public:
+    explicit TimingStream(const char *name);
+    void setRequestedRate(double fps);
+    void mark();
+    void reset();
+
+    double requestedRate() const;
+    double achievedRate() const;
+    quint64 missedDeadlines() const;
+    const TimingHistogram &intervals() const;
+    const TimingHistogram &jitter() const;
+    QString summary() const;
+    std::string toJson() const;
+    std::string toCsv() const;
+
+private:
+    const char *name;
+    double requested;
+    QElapsedTimer clock;
+    qint64 last;
+    qint64 first;
+    quint64 missed;
+    TimingHistogram intervalHistogram;
+    TimingHistogram jitterHistogram;
+};
+
+// Timer ticks and presented frames of one widget
+class FrameTiming
+{
+public:
+    explicit FrameTiming(double fps);
+    TimingStream ticks;
+    TimingStream frames;
+
+    QString summary() const;
+    // Writes <prefix>.csv and <prefix>.json
+    bool save(const std::string &prefix) const;
+};
+
+#endif // FRAMETIMING_H
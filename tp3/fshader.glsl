@@ -1,19 +1,42 @@
-#ifdef GL_ES
-// Set default precision to medium
-precision mediump int;
-precision mediump float;
+#version 330
+
+#ifdef TEXTURED
+uniform sampler2D u_texture;
+
+in vec2 v_texcoord;
 #endif
+in vec4 v_color;
 
-uniform sampler2D texture;
+#ifdef WIREFRAME
+noperspective in vec3 v_barycentric;
+#endif
 
-varying vec2 v_texcoord;
-varying vec4 v_color;
+out vec4 fragColor;
 
 //! [0]
 void main()
 {
+#ifdef TEXTURED
     // Set fragment color from texture
-    gl_FragColor = texture2D(texture, v_texcoord) * v_color;
+    vec4 color = texture(u_texture, v_texcoord) * v_color;
+#else
+    // Plain white texture : the colour alone gives the same result
+    vec4 color = v_color;
+#endif
+
+#ifdef WIREFRAME
+    // About one pixel from the nearest edge, antialiased
+    vec3 fromEdge = smoothstep(vec3(0.0), fwidth(v_barycentric) * 1.2, v_barycentric);
+    float edge = 1.0 - min(min(fromEdge.x, fromEdge.y), fromEdge.z);
+#ifdef WIRE_FILL
+    color = vec4(mix(color.rgb * 0.3, color.rgb, edge), color.a);
+#else
+    if (edge < 0.01)
+        discard;
+    color.rgb *= edge;
+#endif
+#endif
+
+    fragColor = color;
 }
 //! [0]
-
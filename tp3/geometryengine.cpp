@@ -50,19 +50,125 @@
 
 #include "geometryengine.h"
 #include "quadnode.h"
-
+#include "profiler.h"
+#include "shaderlibrary.h"
+#include "indexoptimizer.h"
+#include "terraincache.h"
+#include "lodrefiner.h"
+#include "framescheduler.h"
+
+#include <QOpenGLPixelTransferOptions>
 #include <QVector2D>
 #include <QVector3D>
 #include <QImage>
+#include <cfloat>
+#include <cstddef>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 unsigned int GeometryEngine::width;
 unsigned int GeometryEngine::height;
 QImage GeometryEngine::heightMap;
+HeightField<quint8, RowMajorLayout, TerrainRange> GeometryEngine::heightField;
+HeightPyramid GeometryEngine::heightPyramid;
+MinMaxPyramid GeometryEngine::heightRanges;
+SampleStore<QVector3D> GeometryEngine::normalMap;
+GeometryEngine *GeometryEngine::shared = nullptr;
+int GeometryEngine::users = 0;
+QByteArray GeometryEngine::sourceHash;
+TerrainMesh GeometryEngine::bakedMesh;
+bool GeometryEngine::gpuDisplacement = false;
+
+namespace
+{
+    const char *const heightMapSource = ":/heightmap-1.png";
+
+    // Heights of the plane : qGray / 255 * 1.5 + 1.5
+    struct PlaneRange
+    {
+        static constexpr float scale = 1.5f;
+        static constexpr float bias = 1.5f;
+    };
+
+    GLushort quantize(float value)
+    {
+        return static_cast<GLushort>(qBound(0.f, value, 1.f) * 65535.f + .5f);
+    }
+
+    // 12 bytes per vertex instead of 20
+    std::vector<PackedVertexData> packVertices(const VertexData *vertices, unsigned int count)
+    {
+        std::vector<PackedVertexData> packed(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const VertexData &v = vertices[i];
+            packed[i] = { { quantize((v.position.x() - QuadNode::startx) / QuadNode::width),
+                            quantize((QuadNode::starty - v.position.y()) / QuadNode::height),
+                            quantize((v.position.z() - GeometryEngine::heightBias) / GeometryEngine::heightScale) },
+                          0,
+                          { quantize(v.texCoord.x()), quantize(v.texCoord.y()) } };
+        }
+        return packed;
+    }
+
+    // Bounds of the leaves of a chunk
+    void chunkBounds(ChunkMesh &chunk, bool displaced)
+    {
+        chunk.min = QVector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+        chunk.max = QVector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (const VertexData &vertex : chunk.vertices)
+        {
+            const QVector3D &p = vertex.position;
+            chunk.min = QVector3D(std::min(chunk.min.x(), p.x()), std::min(chunk.min.y(), p.y()), std::min(chunk.min.z(), p.z()));
+            chunk.max = QVector3D(std::max(chunk.max.x(), p.x()), std::max(chunk.max.y(), p.y()), std::max(chunk.max.z(), p.z()));
+        }
+
+        // Heights are left to the vertex shader : bounds of the texels it can fetch, one cell around
+        if (displaced && !GeometryEngine::heightRanges.isNull())
+        {
+            const float marginU = 1.f / std::max(GeometryEngine::heightField.width() - 1, 1);
+            const float marginV = 1.f / std::max(GeometryEngine::heightField.height() - 1, 1);
+            HeightRange range = GeometryEngine::heightRanges.range((chunk.min.x() - QuadNode::startx) / QuadNode::width - marginU,
+                                                                   (QuadNode::starty - chunk.max.y()) / QuadNode::height - marginV,
+                                                                   (chunk.max.x() - QuadNode::startx) / QuadNode::width + marginU,
+                                                                   (QuadNode::starty - chunk.min.y()) / QuadNode::height + marginV);
+            chunk.min.setZ(range.min);
+            chunk.max.setZ(range.max);
+        }
+    }
+
+    // Central differences in terrain units, one sided on the borders
+    SampleStore<QVector3D> computeNormals(const HeightField<quint8, RowMajorLayout, TerrainRange> &heights)
+    {
+        PROFILE_ZONE("computeNormals");
+        const int w = heights.width();
+        const int h = heights.height();
+        SampleStore<QVector3D> normals(heights.layout().size());
+        const float stepX = QuadNode::width / std::max(w - 1, 1);
+        const float stepY = QuadNode::height / std::max(h - 1, 1);
+        for (int y = 0; y < h; y++)
+        {
+            int north = std::max(y - 1, 0), south = std::min(y + 1, h - 1);
+            for (int x = 0; x < w; x++)
+            {
+                int west = std::max(x - 1, 0), east = std::min(x + 1, w - 1);
+                float dx = (heights.at(east, y) - heights.at(west, y)) / (std::max(east - west, 1) * stepX);
+                // Rows go south while y goes north
+                float dy = (heights.at(x, north) - heights.at(x, south)) / (std::max(south - north, 1) * stepY);
+                normals[heights.layout().offset(x, y)] = QVector3D(-dx, -dy, 1.f).normalized();
+            }
+        }
+        return normals;
+    }
+}
 
 //! [0]
 GeometryEngine::GeometryEngine()
-    : indexBuf(QOpenGLBuffer::IndexBuffer)
+    : indexBuf(QOpenGLBuffer::IndexBuffer), heightTexture(nullptr), packedVertices(false),
+      taille_vertices(0), taille_indices(0), triangles(0), indexType(GL_UNSIGNED_SHORT), optimizeIndices(true),
+      acmrGenerated(0.f), acmrDrawn(0.f), uploadBytes(0), built(false), refiner(new LodRefiner), refineUs(defaultRefineBudget),
+      refinedFrame(std::numeric_limits<quint64>::max())
 {
     initializeOpenGLFunctions();
 
@@ -72,16 +178,325 @@ GeometryEngine::GeometryEngine()
 
     // Initializes cube geometry and transfers it to VBOs
     //initPlaneGeometry();
-    initQuadTree();
+    // The quadtree itself is built by the first update()
+    if (loadHeightMap())
+    {
+        // Sampled texel by texel with GPU displacement, rows of heightField are byte aligned
+        QOpenGLPixelTransferOptions rows;
+        rows.setAlignment(1);
+        heightTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        heightTexture->setSize(heightField.width(), heightField.height());
+        heightTexture->setFormat(QOpenGLTexture::R8_UNorm);
+        heightTexture->setMipLevels(1);
+        heightTexture->allocateStorage();
+        heightTexture->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt8, qAsConst(heightField).data(), &rows);
+        heightTexture->setMinificationFilter(QOpenGLTexture::Nearest);
+        heightTexture->setMagnificationFilter(QOpenGLTexture::Nearest);
+        heightTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
 }
 
 GeometryEngine::~GeometryEngine()
 {
+    // Vertex arrays of contexts already gone were destroyed with them
+    releaseVertexArray();
+    for (VertexArray &entry : vertexArrays)
+        delete entry.vao;
+    delete heightTexture;
+    delete refiner;
     arrayBuf.destroy();
     indexBuf.destroy();
 }
 //! [0]
 
+GeometryEngine *GeometryEngine::acquire()
+{
+    if (shared == nullptr)
+        shared = new GeometryEngine;
+    users++;
+    return shared;
+}
+
+void GeometryEngine::release()
+{
+    // The last user must have a context of the share group current
+    if (--users == 0)
+    {
+        delete shared;
+        shared = nullptr;
+    }
+}
+
+bool GeometryEngine::hasTerrain()
+{
+    return shared != nullptr && shared->built;
+}
+
+QVector3D GeometryEngine::drawnFocus(float x, float y)
+{
+    if (!hasTerrain())
+        return QuadNode::p;
+    // The refiner's chunks are the ones in the buffers, see update()
+    const LodRefiner &refiner = *shared->refiner;
+    const int cells = chunkCells();
+    if (refiner.isNull() || refiner.chunkMeshes().size() != static_cast<size_t>(cells * cells))
+        return shared->builtFor;
+    // Same cell as LodRefiner::adopt(), a point on a border goes east and south like the descent
+    int column = qBound(0, static_cast<int>((x - QuadNode::startx) / QuadNode::width * cells), cells - 1);
+    int row = qBound(0, static_cast<int>((QuadNode::starty - y) / QuadNode::height * cells), cells - 1);
+    return refiner.chunkMeshes()[static_cast<size_t>(row * cells + column)].focus;
+}
+
+bool GeometryEngine::loadHeightMap()
+{
+    PROFILE_ZONE("loadHeightMap");
+    if (!heightField.isNull())
+        return true;
+
+    sourceHash = TerrainCache::sourceHash(heightMapSource);
+    if (sourceHash.isEmpty()) {
+            std::cerr << "Error : no such file." << std::endl;
+            return false;
+    }
+
+    TerrainCache::Contents contents;
+    if (TerrainCache::load(heightMapSource, sourceHash, contents))
+    {
+        heightField = contents.heights;
+        heightPyramid.setLevels(std::move(contents.pyramid));
+        heightRanges.setLevels(std::move(contents.ranges), heightField.width() - 1, heightField.height() - 1);
+        normalMap = contents.normals;
+        bakedMesh = std::move(contents.mesh);
+    }
+    else
+    {
+        QImage image;
+        if(!image.load(heightMapSource)) {
+                std::cerr << "Error : no such file." << std::endl;
+                return false;
+        }
+        heightField = HeightField<quint8, RowMajorLayout, TerrainRange>(image);
+        const HeightField<float> normalized(heightField);
+        heightPyramid.build(normalized);
+        heightRanges.build(normalized);
+        normalMap = computeNormals(heightField);
+    }
+
+    height = static_cast<unsigned int>(heightField.height());
+    width = static_cast<unsigned int>(heightField.width());
+    return true;
+}
+
+TerrainMesh GeometryEngine::takeBakedMesh()
+{
+    TerrainMesh mesh = std::move(bakedMesh);
+    bakedMesh = TerrainMesh();
+    if (mesh.focus != QuadNode::p || mesh.displaced != gpuDisplacement)
+        return TerrainMesh();
+    return mesh;
+}
+
+void GeometryEngine::bakeTerrain(const TerrainMesh &mesh)
+{
+    TerrainCache::save(heightMapSource, sourceHash, heightField, heightPyramid, heightRanges, normalMap, mesh);
+}
+
+void GeometryEngine::update(GLStateCache &state)
+{
+    // Chunks keep their leaves until their turn comes
+    if (built && refineUs > 0 && !refiner->isNull())
+    {
+        // Every view draws the same buffers : the first one painted in a frame refines for all
+        uploadBytes = 0;
+        quint64 frame = FrameScheduler::instance()->frame();
+        if (frame == refinedFrame)
+            return;
+        refinedFrame = frame;
+
+        // The budget covers the uploads too : each chunk goes to its slot as soon as it is built.
+        // One that outgrew its slot stops the refine, every slot is laid out again
+        QElapsedTimer clock;
+        clock.start();
+        bool overflow = false;
+        auto place = [&](int index, const ChunkMesh &part)
+        {
+            overflow = !uploadChunk(state, index, part);
+            return !overflow;
+        };
+        if (refiner->refine(clock, refineUs, optimizeIndices, place))
+        {
+            if (overflow)
+                uploadChunks(state, refiner->chunkMeshes());
+            else
+                chunkStatistics(refiner->chunkMeshes());
+        }
+        // Where autoMovePoint() takes the focus next : the chunks it will need are built meanwhile
+        std::vector<QVector3D> path(1, QuadNode::p);
+        for (int i = 0; i < LodRefiner::lookahead; i++)
+            path.push_back(nextFocus(path.back()));
+        if (path.back() != QuadNode::p)
+            refiner->prefetch(path, optimizeIndices);
+        return;
+    }
+    if (built && builtFor == QuadNode::p)
+    {
+        uploadBytes = 0;
+        return;
+    }
+    initQuadTree(state);
+}
+
+qint64 GeometryEngine::refineBudget() const
+{
+    return refineUs;
+}
+
+void GeometryEngine::setRefineBudget(qint64 us)
+{
+    if (us == refineUs)
+        return;
+    // Whatever was left pending is built at once
+    refiner->cancelPrefetch();
+    refineUs = us;
+    built = false;
+}
+
+int GeometryEngine::pendingChunks() const
+{
+    return refineUs > 0 ? refiner->pendingChunks() : 0;
+}
+
+int GeometryEngine::neededChunks() const
+{
+    return refineUs > 0 ? refiner->neededChunks() : 0;
+}
+
+int GeometryEngine::notReadyChunks() const
+{
+    return refineUs > 0 ? refiner->notReadyChunks() : 0;
+}
+
+qint64 GeometryEngine::totalNeededChunks() const
+{
+    return refiner->totalNeededChunks();
+}
+
+qint64 GeometryEngine::totalNotReadyChunks() const
+{
+    return refiner->totalNotReadyChunks();
+}
+
+GLuint GeometryEngine::vertexArray(GLStateCache &state)
+{
+    VertexArray &entry = vertexArrays[QOpenGLContext::currentContext()];
+    if (entry.vao == nullptr)
+    {
+        entry.vao = new QOpenGLVertexArrayObject;
+        entry.vao->create();
+    }
+    if (entry.configured && entry.packed == packedVertices)
+        return entry.vao->objectId();
+
+    // Buffers and attribute layout are recorded once per vertex format, drawing only binds the VAO
+    state.bindVertexArray(entry.vao->objectId());
+
+    // Tell OpenGL which VBOs to use
+    state.bindBuffer(GL_ARRAY_BUFFER, arrayBuf.bufferId());
+    indexBuf.bind();
+
+    // Tell OpenGL programmable pipeline how to locate vertex position and texture coordinate data
+    glEnableVertexAttribArray(positionLocation);
+    glEnableVertexAttribArray(texcoordLocation);
+    if (packedVertices)
+    {
+        glVertexAttribPointer(positionLocation, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertexData), reinterpret_cast<const void *>(offsetof(PackedVertexData, position)));
+        glVertexAttribPointer(texcoordLocation, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertexData), reinterpret_cast<const void *>(offsetof(PackedVertexData, texCoord)));
+    }
+    else
+    {
+        glVertexAttribPointer(positionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offsetof(VertexData, position)));
+        glVertexAttribPointer(texcoordLocation, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), reinterpret_cast<const void *>(offsetof(VertexData, texCoord)));
+    }
+    entry.packed = packedVertices;
+    entry.configured = true;
+    return entry.vao->objectId();
+}
+
+void GeometryEngine::releaseVertexArray()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    delete vertexArrays.take(context).vao;
+}
+
+int GeometryEngine::vertexFeatures() const
+{
+    return (gpuDisplacement ? ShaderGpuDisplacement : 0) | (packedVertices ? ShaderPackedVertices : 0);
+}
+
+void GeometryEngine::setVertexFeatures(int features)
+{
+    bool displaced = (features & ShaderGpuDisplacement) != 0 && heightTexture != nullptr;
+    bool packed = (features & ShaderPackedVertices) != 0;
+    if (displaced == gpuDisplacement && packed == packedVertices)
+        return;
+
+    // Vertices change content or layout : rebuild on the next update()
+    refiner->cancelPrefetch();
+    gpuDisplacement = displaced;
+    packedVertices = packed;
+    built = false;
+}
+
+GLuint GeometryEngine::heightTextureId() const
+{
+    return heightTexture != nullptr ? heightTexture->textureId() : 0;
+}
+
+bool GeometryEngine::indexOptimization() const
+{
+    return optimizeIndices;
+}
+
+void GeometryEngine::setIndexOptimization(bool enabled)
+{
+    if (enabled == optimizeIndices)
+        return;
+    refiner->cancelPrefetch();
+    optimizeIndices = enabled;
+    built = false;
+}
+
+void GeometryEngine::setDetail(int startDepth, float maxDist)
+{
+    if (startDepth == QuadNode::startDepth && maxDist == QuadNode::maxDist)
+        return;
+    const int cells = chunkCells();
+    // The prefetch job reads the QuadNode parameters
+    refiner->cancelPrefetch();
+    QuadNode::startDepth = startDepth;
+    QuadNode::maxDist = maxDist;
+    // Built for the previous detail. The refiner moves the chunks to the new one
+    // as long as their grid stays the same
+    prebuilt = TerrainMesh();
+    if (refineUs == 0 || chunkCells() != cells)
+        built = false;
+}
+
+float GeometryEngine::generatedAcmr() const
+{
+    return acmrGenerated;
+}
+
+float GeometryEngine::drawnAcmr() const
+{
+    return acmrDrawn;
+}
+
+unsigned int GeometryEngine::vertexCount() const
+{
+    return taille_vertices;
+}
+
 void GeometryEngine::initPlaneGeometry()
 {
     if(!heightMap.load(":/heightmap-1.png")) {
@@ -93,6 +508,7 @@ void GeometryEngine::initPlaneGeometry()
     width = static_cast<unsigned int>(heightMap.width());
 
     int size = 64;
+    const HeightField<quint8, RowMajorLayout, PlaneRange> heights(heightMap);
 
     // Create array of 16 x 16 vertices facing the camera  (z=cte)
     VertexData *vertices = new VertexData[size*size];
@@ -101,29 +517,26 @@ void GeometryEngine::initPlaneGeometry()
         for (int j=0;j<size;j++)
             {
                 // Vertex data for face 0
-                vertices[size*i+j] = { QVector3D(0.1f*(i-size/2),0.1f*(j-size/2), qGray(heightMap.pixel(static_cast<int>(height / size * i), static_cast<int>(width / size * j))) / 255.0f * 1.5f + 1.5f), QVector2D(static_cast<float>(i) / size,static_cast<float>(j) / static_cast<float>(size))};
+                vertices[size*i+j] = { QVector3D(0.1f*(i-size/2),0.1f*(j-size/2), heights.at(static_cast<int>(height / size * i), static_cast<int>(width / size * j))), QVector2D(static_cast<float>(i) / size,static_cast<float>(j) / static_cast<float>(size))};
                 // add height field eg (i-8)*(j-8)/256.0
         }
 
-    // Draw 15 bands each with 32 vertices, with repeated vertices at the end of each band
-    int nbv = size * 2 + 4;
-        taille_vertices = nbv * (size - 1);
-        GLushort *indices = new GLushort[(size - 1) * nbv];
-
-        for (unsigned int i=0;i<size-1;i++)
-            {
-                indices[nbv*i] = size * i;
-                indices[nbv*i+1] = size * i;
-
-                for (unsigned int j=2;j<nbv;j+=2)
-                    {
-                        indices[nbv*i+j] = size*i +(j-2)/2;
-                        indices[nbv*i+j+1] = size*(i+1) + (j-2)/2;
-                    }
-
-                indices[nbv*i+nbv - 2] = size*(i+1) + size - 1;
-                indices[nbv*i+nbv - 1] = size*(i+1) + size - 1;
+    // One strip per band, separated by a restart index instead of degenerate triangles
+    const GLuint restart = 0xFFFF;
+    std::vector<GLuint> indices;
+    indices.reserve((size - 1) * (size * 2 + 1));
+    for (int i = 0; i < size - 1; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            indices.push_back(size * i + j);
+            indices.push_back(size * (i + 1) + j);
         }
+        indices.push_back(restart);
+    }
+    acmrGenerated = acmrDrawn = IndexOptimizer::acmrStrip(indices, size * size, restart);
+    taille_vertices = static_cast<unsigned int>(indices.size());
+    indexType = GL_UNSIGNED_SHORT;
 
     //! [1]
         // Transfer vertex data to VBO 0
@@ -132,36 +545,49 @@ void GeometryEngine::initPlaneGeometry()
 
         // Transfer index data to VBO 1
         indexBuf.bind();
-        indexBuf.allocate(indices, (size - 1) * nbv * sizeof(GLushort));
+        std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+        indexBuf.allocate(shortIndices.data(), static_cast<int>(shortIndices.size() * sizeof(GLushort)));
     //! [1]
-        free(vertices);
-        free(indices);
+        delete[] vertices;
     }
 
-void GeometryEngine::initQuadTree()
+TerrainMesh GeometryEngine::buildMesh(bool optimizeIndices)
 {
-    if(!heightMap.load(":/heightmap-1.png")) {
-            std::cerr << "Error : no such file." << std::endl;
-            return;
-    }
+    PROFILE_ZONE("buildMesh");
+    TerrainMesh mesh;
+    if (heightField.isNull())
+        return mesh;
+    mesh.focus = QuadNode::p;
+    mesh.displaced = gpuDisplacement;
+    mesh.optimized = optimizeIndices;
+
+    // Every chunk at once, the LodRefiner rebuilds them a few at a time
+    const int cells = chunkCells();
+    std::vector<ChunkMesh> parts;
+    parts.reserve(static_cast<size_t>(cells * cells));
+    for (int y = 0; y < cells; y++)
+        for (int x = 0; x < cells; x++)
+            parts.push_back(buildChunkMesh(x, y, optimizeIndices, QuadNode::p));
+    assembleMesh(parts, mesh);
+    return mesh;
+}
 
-    height = heightMap.height();
-    width = heightMap.width();
+int GeometryEngine::chunkCells()
+{
+    return 1 << std::min(chunkDepth, QuadNode::startDepth);
+}
 
+ChunkMesh GeometryEngine::buildChunkMesh(int x, int y, bool optimizeIndices, const QVector3D &focus)
+{
+    ChunkMesh chunk;
+    chunk.focus = focus;
     // Create array of 16 x 16 vertices facing the camera  (z=cte)
-    VertexData *vertices = getVertices();
-    taille_vertices = QuadNode::nb_vertices * 4;
-    /*
-    for (int i = 0; i < taille_vertices; i++)
-    {
-        std::cout << vertices[i].position.x() << "  " << vertices[i].position.y() << "  " << vertices[i].position.z() << std::endl;
-    }
-    */
-    // Draw 15 bands each with 32 vertices, with repeated vertices at the end of each band
-    taille_indices = QuadNode::nb_vertices * 6;
-    GLushort *indices = new GLushort[taille_indices];
-//    std::cerr << "taille vertices = " << taille_vertices << "\ntaille indice = " << taille_indices << std::endl;
-    for(int i = 0, j = 0; i < taille_indices; i += 6, j += 4)
+    chunk.vertices = getVertices(x, y, std::min(chunkDepth, QuadNode::startDepth), focus);
+    unsigned int vertexCount = static_cast<unsigned int>(chunk.vertices.size());
+    // Two triangles per leaf, each leaf with its own 4 vertices
+    std::vector<GLuint> &indices = chunk.indices;
+    indices.resize(vertexCount / 4 * 6);
+    for(unsigned int i = 0, j = 0; i < indices.size(); i += 6, j += 4)
     {
         //horaire
         /*
@@ -180,77 +606,316 @@ void GeometryEngine::initQuadTree()
         indices[i + 4] = j + 1;
         indices[i + 5] = j;
     }
-    /*
-    for (int i = 0; i < taille_indices; i++)
+    chunk.acmrGenerated = IndexOptimizer::acmr(indices, vertexCount);
+    if (optimizeIndices)
+    {
+        // Neighbouring leaves share their corners : one vertex each, then triangles
+        // reordered for the post-transform cache and vertices for the fetches
+        vertexCount = IndexOptimizer::weldVertices(chunk.vertices.data(), vertexCount, indices);
+        IndexOptimizer::optimizeVertexCache(indices, vertexCount);
+        vertexCount = IndexOptimizer::optimizeVertexFetch(chunk.vertices.data(), vertexCount, indices);
+        chunk.vertices.resize(vertexCount);
+    }
+    chunk.acmrDrawn = IndexOptimizer::acmr(indices, vertexCount);
+    chunkBounds(chunk, gpuDisplacement);
+    return chunk;
+}
+
+void GeometryEngine::assembleMesh(const std::vector<ChunkMesh> &parts, TerrainMesh &mesh)
+{
+    PROFILE_ZONE("assembleMesh");
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (const ChunkMesh &part : parts)
+    {
+        vertexCount += part.vertices.size();
+        indexCount += part.indices.size();
+    }
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.chunks.clear();
+    mesh.vertices.reserve(vertexCount);
+    mesh.indices.reserve(indexCount);
+    mesh.chunks.reserve(parts.size());
+
+    // Chunks follow each other in both buffers, their indices offset by the vertices before them
+    float generated = 0.f;
+    float drawn = 0.f;
+    for (const ChunkMesh &part : parts)
     {
-        std::cout << indices[i] << std::endl;
+        GLuint base = static_cast<GLuint>(mesh.vertices.size());
+        GLuint first = static_cast<GLuint>(mesh.indices.size());
+        mesh.vertices.insert(mesh.vertices.end(), part.vertices.begin(), part.vertices.end());
+        for (GLuint index : part.indices)
+            mesh.indices.push_back(base + index);
+        mesh.chunks.push_back({ first, static_cast<GLuint>(part.indices.size()), part.min, part.max });
+        generated += part.acmrGenerated * part.indices.size();
+        drawn += part.acmrDrawn * part.indices.size();
     }
-    */
+    mesh.acmrGenerated = indexCount > 0 ? generated / indexCount : 0.f;
+    mesh.acmrDrawn = indexCount > 0 ? drawn / indexCount : 0.f;
+}
+
+void GeometryEngine::setPrebuiltMesh(TerrainMesh mesh)
+{
+    if (!mesh.vertices.empty())
+        prebuilt = std::move(mesh);
+}
+
+void GeometryEngine::initQuadTree(GLStateCache &state)
+{
+    PROFILE_ZONE("initQuadTree");
+    // A whole build is this frame's share of work on the terrain
+    refinedFrame = FrameScheduler::instance()->frame();
+    uploadBytes = 0;
+    // Built ahead for this very focus point and vertex content : only the upload is left
+    TerrainMesh mesh;
+    if (!prebuilt.vertices.empty() && prebuilt.focus == QuadNode::p
+            && prebuilt.displaced == gpuDisplacement && prebuilt.optimized == optimizeIndices)
+        mesh = std::move(prebuilt);
+    else
+        mesh = buildMesh(optimizeIndices);
+    // Every chunk is on target : the next updates only refine, in place
+    refiner->adopt(mesh);
+    chunkSlots.clear();
+    if (refiner->isNull())
+        upload(state, mesh);
+    else
+        uploadChunks(state, refiner->chunkMeshes());
+    built = true;
+    builtFor = mesh.focus;
+    prebuilt = TerrainMesh();
+}
+
+void GeometryEngine::upload(GLStateCache &state, const TerrainMesh &mesh)
+{
+    if (mesh.vertices.empty())
+        return;
+    taille_vertices = static_cast<unsigned int>(mesh.vertices.size());
+    taille_indices = static_cast<unsigned int>(mesh.indices.size());
+    triangles = taille_indices / 3;
+    uploadedChunks = mesh.chunks;
+    acmrGenerated = mesh.acmrGenerated;
+    acmrDrawn = mesh.acmrDrawn;
+
     //! [1]
-    // Transfer vertex data to VBO 0
-    arrayBuf.bind();
-    arrayBuf.allocate(vertices, taille_vertices * sizeof(VertexData));
+    {
+        PROFILE_ZONE("upload");
+        // Buffer names don't change, the vertex arrays of every context stay valid.
+        // The index buffer is part of the vertex array state : upload through our own
+        state.bindVertexArray(vertexArray(state));
 
-    // Transfer index data to VBO 1
-    indexBuf.bind();
-    indexBuf.allocate(indices, taille_indices * sizeof(GLushort));
+        // Transfer vertex data to VBO 0
+        state.bindBuffer(GL_ARRAY_BUFFER, arrayBuf.bufferId());
+        if (packedVertices)
+        {
+            std::vector<PackedVertexData> packed = packVertices(mesh.vertices.data(), taille_vertices);
+            arrayBuf.allocate(packed.data(), static_cast<int>(packed.size() * sizeof(PackedVertexData)));
+        }
+        else
+            arrayBuf.allocate(mesh.vertices.data(), taille_vertices * sizeof(VertexData));
+
+        // Transfer index data to VBO 1
+        uploadIndices(mesh.indices, taille_vertices);
+    }
     //! [1]
-    free(vertices);
-    free(indices);
+    uploadBytes = taille_vertices * (packedVertices ? sizeof(PackedVertexData) : sizeof(VertexData))
+                + taille_indices * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
 }
 
-//! [2]
-void GeometryEngine::drawPlaneGeometry(QOpenGLShaderProgram *program)
+void GeometryEngine::uploadChunks(GLStateCache &state, const std::vector<ChunkMesh> &parts)
 {
-    // Tell OpenGL which VBOs to use
-    arrayBuf.bind();
-    indexBuf.bind();
+    PROFILE_ZONE("uploadChunks");
+    // Half as much again as the chunk needs now, never less than the slot had
+    auto capacity = [](size_t size, GLuint previous) { return std::max(static_cast<GLuint>(size + size / 2), previous); };
+    const bool regrow = chunkSlots.size() == parts.size();
+    std::vector<ChunkSlot> layout(parts.size());
+    GLuint vertexTotal = 0;
+    GLuint indexTotal = 0;
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        ChunkSlot &slot = layout[i];
+        slot.firstVertex = vertexTotal;
+        slot.vertexCapacity = capacity(parts[i].vertices.size(), regrow ? chunkSlots[i].vertexCapacity : 0);
+        slot.vertexCount = static_cast<GLuint>(parts[i].vertices.size());
+        slot.firstIndex = indexTotal;
+        slot.indexCapacity = capacity(parts[i].indices.size(), regrow ? chunkSlots[i].indexCapacity : 0);
+        vertexTotal += slot.vertexCapacity;
+        indexTotal += slot.indexCapacity;
+    }
+    chunkSlots = std::move(layout);
+
+    // Room left in the vertex slots is never indexed, in the index slots it is padding
+    TerrainMesh mesh;
+    mesh.vertices.resize(vertexTotal);
+    mesh.indices.resize(indexTotal);
+    uploadedChunks.resize(parts.size());
+    taille_vertices = 0;
+    triangles = 0;
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        const ChunkSlot &slot = chunkSlots[i];
+        const ChunkMesh &part = parts[i];
+        std::copy(part.vertices.begin(), part.vertices.end(), mesh.vertices.begin() + slot.firstVertex);
+        GLuint *indices = mesh.indices.data() + slot.firstIndex;
+        for (size_t j = 0; j < part.indices.size(); j++)
+            indices[j] = slot.firstVertex + part.indices[j];
+        std::fill(indices + part.indices.size(), indices + slot.indexCapacity, slot.firstVertex);
+        uploadedChunks[i] = { slot.firstIndex, static_cast<GLuint>(part.indices.size()), part.min, part.max };
+        taille_vertices += slot.vertexCount;
+        triangles += static_cast<unsigned int>(part.indices.size() / 3);
+    }
 
-    // Offset for position
-    quintptr offset = 0;
+    {
+        PROFILE_ZONE("upload");
+        state.bindVertexArray(vertexArray(state));
+        state.bindBuffer(GL_ARRAY_BUFFER, arrayBuf.bufferId());
+        if (packedVertices)
+        {
+            std::vector<PackedVertexData> packed = packVertices(mesh.vertices.data(), vertexTotal);
+            arrayBuf.allocate(packed.data(), static_cast<int>(packed.size() * sizeof(PackedVertexData)));
+        }
+        else
+            arrayBuf.allocate(mesh.vertices.data(), static_cast<int>(vertexTotal * sizeof(VertexData)));
+        uploadIndices(mesh.indices, vertexTotal);
+    }
+    taille_indices = indexTotal;
+    uploadBytes += vertexTotal * (packedVertices ? sizeof(PackedVertexData) : sizeof(VertexData))
+                 + indexTotal * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+    chunkStatistics(parts);
+}
 
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+bool GeometryEngine::uploadChunk(GLStateCache &state, int index, const ChunkMesh &part)
+{
+    ChunkSlot &slot = chunkSlots[static_cast<size_t>(index)];
+    if (part.vertices.size() > slot.vertexCapacity || part.indices.size() > slot.indexCapacity)
+        return false;
+    PROFILE_ZONE("uploadChunk");
+
+    // Through our own vertex array, the index buffer is part of its state
+    state.bindVertexArray(vertexArray(state));
+    state.bindBuffer(GL_ARRAY_BUFFER, arrayBuf.bufferId());
+    const int vertexBytes = static_cast<int>(part.vertices.size() * (packedVertices ? sizeof(PackedVertexData) : sizeof(VertexData)));
+    if (packedVertices)
+    {
+        std::vector<PackedVertexData> packed = packVertices(part.vertices.data(), static_cast<unsigned int>(part.vertices.size()));
+        arrayBuf.write(static_cast<int>(slot.firstVertex * sizeof(PackedVertexData)), packed.data(), vertexBytes);
+    }
+    else
+        arrayBuf.write(static_cast<int>(slot.firstVertex * sizeof(VertexData)), part.vertices.data(), vertexBytes);
 
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
+    // The whole slot : the padding moves behind the new indices
+    int indexBytes;
+    if (indexType == GL_UNSIGNED_SHORT)
+    {
+        std::vector<GLushort> indices(slot.indexCapacity, static_cast<GLushort>(slot.firstVertex));
+        for (size_t j = 0; j < part.indices.size(); j++)
+            indices[j] = static_cast<GLushort>(slot.firstVertex + part.indices[j]);
+        indexBytes = static_cast<int>(indices.size() * sizeof(GLushort));
+        indexBuf.write(static_cast<int>(slot.firstIndex * sizeof(GLushort)), indices.data(), indexBytes);
+    }
+    else
+    {
+        std::vector<GLuint> indices(slot.indexCapacity, slot.firstVertex);
+        for (size_t j = 0; j < part.indices.size(); j++)
+            indices[j] = slot.firstVertex + part.indices[j];
+        indexBytes = static_cast<int>(indices.size() * sizeof(GLuint));
+        indexBuf.write(static_cast<int>(slot.firstIndex * sizeof(GLuint)), indices.data(), indexBytes);
+    }
 
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+    TerrainChunk &chunk = uploadedChunks[static_cast<size_t>(index)];
+    taille_vertices += static_cast<unsigned int>(part.vertices.size()) - slot.vertexCount;
+    triangles += static_cast<unsigned int>(part.indices.size() / 3) - chunk.indexCount / 3;
+    slot.vertexCount = static_cast<GLuint>(part.vertices.size());
+    chunk = { slot.firstIndex, static_cast<GLuint>(part.indices.size()), part.min, part.max };
+    uploadBytes += vertexBytes + indexBytes;
+    return true;
+}
 
-    // Draw plane geometry using indices from VBO 1
-    glDrawElements(GL_TRIANGLE_STRIP, taille_vertices, GL_UNSIGNED_SHORT, nullptr);
+void GeometryEngine::chunkStatistics(const std::vector<ChunkMesh> &parts)
+{
+    float generated = 0.f;
+    float drawn = 0.f;
+    size_t indexCount = 0;
+    for (const ChunkMesh &part : parts)
+    {
+        generated += part.acmrGenerated * part.indices.size();
+        drawn += part.acmrDrawn * part.indices.size();
+        indexCount += part.indices.size();
+    }
+    acmrGenerated = indexCount > 0 ? generated / indexCount : 0.f;
+    acmrDrawn = indexCount > 0 ? drawn / indexCount : 0.f;
 }
-//! [2]
 
-//! [2]
-void GeometryEngine::drawQuadTree(QOpenGLShaderProgram *program)
+void GeometryEngine::uploadIndices(const std::vector<GLuint> &indices, unsigned int vertexCount)
 {
-    // Tell OpenGL which VBOs to use
-    arrayBuf.bind();
-    indexBuf.bind();
+    if (vertexCount <= 0xFFFF)
+    {
+        std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+        indexType = GL_UNSIGNED_SHORT;
+        indexBuf.allocate(shortIndices.data(), static_cast<int>(shortIndices.size() * sizeof(GLushort)));
+    }
+    else
+    {
+        indexType = GL_UNSIGNED_INT;
+        indexBuf.allocate(indices.data(), static_cast<int>(indices.size() * sizeof(GLuint)));
+    }
+}
 
-    // Offset for position
-    quintptr offset = 0;
+int GeometryEngine::triangleCount() const
+{
+    return static_cast<int>(triangles);
+}
 
-    // Tell OpenGL programmable pipeline how to locate vertex position data
-    int vertexLocation = program->attributeLocation("a_position");
-    program->enableAttributeArray(vertexLocation);
-    program->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+qint64 GeometryEngine::uploadedBytes() const
+{
+    return uploadBytes;
+}
+
+//! [2]
+void GeometryEngine::drawPlaneGeometry(GLStateCache &state)
+{
+    state.bindVertexArray(vertexArray(state));
+    state.setPrimitiveRestart(true, 0xFFFF);
 
-    // Offset for texture coordinate
-    offset += sizeof(QVector3D);
+    // Draw plane geometry using indices from VBO 1
+    glDrawElements(GL_TRIANGLE_STRIP, taille_vertices, indexType, nullptr);
+}
+//! [2]
 
-    // Tell OpenGL programmable pipeline how to locate vertex texture coordinate data
-    int texcoordLocation = program->attributeLocation("a_texcoord");
-    program->enableAttributeArray(texcoordLocation);
-    program->setAttributeBuffer(texcoordLocation, GL_FLOAT, offset, 2, sizeof(VertexData));
+//! [2]
+void GeometryEngine::drawQuadTree(GLStateCache &state)
+{
+    state.bindVertexArray(vertexArray(state));
+    state.setPrimitiveRestart(false);
 
     // Draw plane geometry using indices from VBO 1
-    glDrawElements(GL_TRIANGLES, taille_indices, GL_UNSIGNED_SHORT, nullptr);
+    glDrawElements(GL_TRIANGLES, taille_indices, indexType, nullptr);
 }
 //! [2]
+
+void GeometryEngine::drawChunks(GLStateCache &state, const std::vector<int> &visible)
+{
+    state.bindVertexArray(vertexArray(state));
+    state.setPrimitiveRestart(false);
+
+    // Neighbouring chunks are contiguous in the index buffer : one draw per run, through the
+    // padding of the slots in between
+    const size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    for (size_t i = 0; i < visible.size();)
+    {
+        const TerrainChunk &first = uploadedChunks[static_cast<size_t>(visible[i])];
+        size_t next = i + 1;
+        while (next < visible.size() && visible[next] == visible[next - 1] + 1)
+            next++;
+        const TerrainChunk &last = uploadedChunks[static_cast<size_t>(visible[next - 1])];
+        GLuint count = last.firstIndex + last.indexCount - first.firstIndex;
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(count), indexType, reinterpret_cast<const void *>(first.firstIndex * indexSize));
+        i = next;
+    }
+}
+
+const std::vector<TerrainChunk> &GeometryEngine::chunks() const
+{
+    return uploadedChunks;
+}
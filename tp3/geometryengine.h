@@ -55,6 +55,16 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QImage>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLContext>
+#include <QOpenGLTexture>
+#include <QHash>
+#include <QByteArray>
+#include <vector>
+
+#include "glstatecache.h"
+#include "heightpyramid.h"
+#include "minmaxpyramid.h"
 
 struct VertexData
 {
@@ -62,25 +72,208 @@ struct VertexData
     QVector2D texCoord;
 };
 
+// Grey levels of the heightmap to heights : qGray / 128 * 1.5 + 1.5
+struct TerrainRange
+{
+    static constexpr float scale = 255.f / 128.f * 1.5f;
+    static constexpr float bias = 1.5f;
+};
+
+// Normalized 16 bit layout, positions relative to the terrain bounds
+struct PackedVertexData
+{
+    GLushort position[3];
+    GLushort padding;
+    GLushort texCoord[2];
+};
+
+// Contiguous indices of the leaves under one quadtree node of depth chunkDepth, with
+// the bounds of their surface in terrain coordinates. Drawn or culled as a whole
+struct TerrainChunk
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+    QVector3D min;
+    QVector3D max;
+};
+
+// Leaves under one chunk node, indexed and optimized on their own so that a chunk can be
+// rebuilt without the others, see LodRefiner
+struct ChunkMesh
+{
+    std::vector<VertexData> vertices;
+    std::vector<GLuint> indices;    // into vertices
+    QVector3D min;
+    QVector3D max;
+    QVector3D focus;                // QuadNode::p the leaves were split around
+    float acmrGenerated = 0.f;
+    float acmrDrawn = 0.f;
+};
+
+// Quadtree mesh built on the CPU, ready to upload. Can be built on any thread
+// as long as nothing moves QuadNode::p meanwhile
+struct TerrainMesh
+{
+    std::vector<VertexData> vertices;
+    std::vector<GLuint> indices;
+    std::vector<TerrainChunk> chunks;
+    QVector3D focus;            // QuadNode::p the tree was built around
+    bool displaced = false;     // heights left to the vertex shader
+    bool optimized = false;     // welded and reordered by IndexOptimizer
+    float acmrGenerated = 0.f;
+    float acmrDrawn = 0.f;
+};
+
+class LodRefiner;
+
 class GeometryEngine : protected QOpenGLFunctions
 {
 public:
     unsigned static int height;
     unsigned static int width;
     static QImage heightMap;
+    // 8 bit samples of the heightmap, and their pre-filtered levels sampled by QuadNode::iteration().
+    // Mapped from the baked terrain when it is up to date, see TerrainCache
+    static HeightField<quint8, RowMajorLayout, TerrainRange> heightField;
+    static HeightPyramid heightPyramid;
+    // Height bounds of the cells between samples
+    static MinMaxPyramid heightRanges;
+    // Unit normal at each sample, in the layout of heightField
+    static SampleStore<QVector3D> normalMap;
+    // Attribute locations, bound before the program is linked
+    static const int positionLocation = 0;
+    static const int texcoordLocation = 1;
+    // Chunks split the terrain in 2^chunkDepth x 2^chunkDepth nodes at most
+    static const int chunkDepth = 4;
+    // Scale and bias of a normalized height
+    static constexpr float heightScale = TerrainRange::scale;
+    static constexpr float heightBias = TerrainRange::bias;
+    // Heights are left to the vertex shader, read by QuadNode::iteration()
+    static bool gpuDisplacement;
     GeometryEngine();
     virtual ~GeometryEngine();
-    void initQuadTree();
-    void drawPlaneGeometry(QOpenGLShaderProgram *program);
-    void drawQuadTree(QOpenGLShaderProgram *program);
+    // One engine shared by every widget of the context share group
+    static GeometryEngine *acquire();
+    static void release();
+    // Maps the baked terrain, or decodes the heightmap and derives the rest
+    static bool loadHeightMap();
+    // Mesh of the baked terrain if it was built for the current focus point, otherwise an empty one
+    static TerrainMesh takeBakedMesh();
+    // Saves the heights, their derived data and the mesh for the next runs
+    static void bakeTerrain(const TerrainMesh &mesh);
+    // A quadtree was uploaded by the shared engine
+    static bool hasTerrain();
+    // Focus point the drawn leaves under (x, y) were split around : chunks reach QuadNode::p
+    // a few at a time. QuadNode::p until a quadtree is uploaded
+    static QVector3D drawnFocus(float x, float y);
+    // Quadtree around the current focus point, needs the height map
+    static TerrainMesh buildMesh(bool optimizeIndices);
+    // Chunks along each side of the terrain
+    static int chunkCells();
+    // Chunk at column x, row y around focus, on any thread
+    static ChunkMesh buildChunkMesh(int x, int y, bool optimizeIndices, const QVector3D &focus);
+    // Chunks one after the other, row by row, in a single mesh
+    static void assembleMesh(const std::vector<ChunkMesh> &parts, TerrainMesh &mesh);
+    // Uploaded by update() instead of building if nothing changed since
+    void setPrebuiltMesh(TerrainMesh mesh);
+    // Rebuilds the quadtree only if the focus point moved since the last build. With a refine
+    // budget, only the chunks that moved furthest from their detail while it lasts, once per
+    // FrameScheduler frame whatever the number of views
+    void update(GLStateCache &state);
+    // Microseconds of chunk rebuilds and uploads per frame, 0 rebuilds the whole tree at once
+    static const qint64 defaultRefineBudget = 4000;
+    qint64 refineBudget() const;
+    void setRefineBudget(qint64 us);
+    // Chunks left off their detail by the last update()
+    int pendingChunks() const;
+    // Chunks the last update() moved to their detail, and those of them the prefetch along
+    // the path of the focus point hadn't built ahead. Totals since the start for the last two
+    int neededChunks() const;
+    int notReadyChunks() const;
+    qint64 totalNeededChunks() const;
+    qint64 totalNotReadyChunks() const;
+    void drawPlaneGeometry(GLStateCache &state);
+    void drawQuadTree(GLStateCache &state);
+    // Only the chunks listed, in increasing order
+    void drawChunks(GLStateCache &state, const std::vector<int> &visible);
+    const std::vector<TerrainChunk> &chunks() const;
+    // Vertex arrays aren't shared : each widget drops its own before its context goes away
+    void releaseVertexArray();
+    int triangleCount() const;
+    qint64 uploadedBytes() const;
+    // ShaderGpuDisplacement and ShaderPackedVertices : how vertices are built and laid out
+    int vertexFeatures() const;
+    void setVertexFeatures(int features);
+    GLuint heightTextureId() const;
+    // Welding and Forsyth reordering of the quadtree indices, see IndexOptimizer
+    bool indexOptimization() const;
+    void setIndexOptimization(bool enabled);
+    // QuadNode::startDepth and QuadNode::maxDist, the tree is rebuilt if they change
+    void setDetail(int startDepth, float maxDist);
+    // Average cache miss ratio of the last build, as generated and as drawn
+    float generatedAcmr() const;
+    float drawnAcmr() const;
+    unsigned int vertexCount() const;
 
 private:
     void initPlaneGeometry();
+    void initQuadTree(GLStateCache &state);
+    void upload(GLStateCache &state, const TerrainMesh &mesh);
+    // Every chunk in its own slot of the buffers, with room to grow
+    void uploadChunks(GLStateCache &state, const std::vector<ChunkMesh> &parts);
+    // Rewrites the slot of one chunk in place, false if it no longer fits
+    bool uploadChunk(GLStateCache &state, int index, const ChunkMesh &part);
+    void chunkStatistics(const std::vector<ChunkMesh> &parts);
+    // GL_UNSIGNED_SHORT indices while every vertex fits in them
+    void uploadIndices(const std::vector<GLuint> &indices, unsigned int vertexCount);
+    // Vertex array of the current context, configured on first use
+    GLuint vertexArray(GLStateCache &state);
     QOpenGLBuffer arrayBuf;
     QOpenGLBuffer indexBuf;
+    QOpenGLTexture *heightTexture;
+
+    struct VertexArray
+    {
+        QOpenGLVertexArrayObject *vao = nullptr;
+        bool packed = false;
+        bool configured = false;
+    };
+    QHash<QOpenGLContext *, VertexArray> vertexArrays;
+    bool packedVertices;
+
+    // Ranges of a chunk in the buffers. Indices past its own repeat its first vertex :
+    // degenerate triangles, so that the whole index buffer can still be drawn at once
+    struct ChunkSlot
+    {
+        GLuint firstVertex;
+        GLuint vertexCapacity;
+        GLuint vertexCount;
+        GLuint firstIndex;
+        GLuint indexCapacity;
+    };
+    std::vector<ChunkSlot> chunkSlots;
 
     unsigned int taille_vertices;
+    // Indices in the buffer, padding of the slots included
     unsigned int taille_indices;
+    unsigned int triangles;
+    GLenum indexType;
+    bool optimizeIndices;
+    float acmrGenerated;
+    float acmrDrawn;
+    qint64 uploadBytes;
+    bool built;
+    QVector3D builtFor;
+    TerrainMesh prebuilt;
+    std::vector<TerrainChunk> uploadedChunks;
+    LodRefiner *refiner;
+    qint64 refineUs;
+    quint64 refinedFrame;
+
+    static GeometryEngine *shared;
+    static int users;
+    static QByteArray sourceHash;
+    static TerrainMesh bakedMesh;
 };
 
 #endif // GEOMETRYENGINE_H
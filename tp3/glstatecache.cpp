@@ -0,0 +1,138 @@
+#include "glstatecache.h"
+
+GLStateCache::GLStateCache(QOpenGLFunctions_4_5_Core *gl)
+    : gl(gl), issuedCount(0), elidedCount(0)
+{
+    invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+    program = vao = activeUnit = unknown;
+    for (GLuint &texture : textures) texture = unknown;
+    arrayBuffer = uniformBuffer = unknown;
+    for (Range &range : ranges) range = { unknown, 0, 0 };
+    restartEnabled = restartIndex = unknown;
+}
+
+bool GLStateCache::needsBind(GLuint &known, GLuint value)
+{
+    if (known == value)
+    {
+        elidedCount++;
+        return false;
+    }
+    known = value;
+    issuedCount++;
+    return true;
+}
+
+bool GLStateCache::needsRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (index >= static_cast<GLuint>(uniformBindings))
+    {
+        issuedCount++;
+        return true;
+    }
+    Range &range = ranges[index];
+    if (range.buffer == buffer && range.offset == offset && range.size == size)
+    {
+        elidedCount++;
+        return false;
+    }
+    range = { buffer, offset, size };
+    issuedCount++;
+    return true;
+}
+
+GLuint &GLStateCache::bufferSlot(GLenum target)
+{
+    if (target == GL_ARRAY_BUFFER)
+        return arrayBuffer;
+    if (target == GL_UNIFORM_BUFFER)
+        return uniformBuffer;
+    // Untracked target : always bind
+    otherBuffer = unknown;
+    return otherBuffer;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if (needsBind(this->program, program))
+        gl->glUseProgram(program);
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+    if (needsBind(this->vao, vao))
+        gl->glBindVertexArray(vao);
+}
+
+void GLStateCache::bindTexture(int unit, GLuint texture)
+{
+    if (unit < 0 || unit >= textureUnits)
+        return;
+    if (textures[unit] == texture)
+    {
+        elidedCount++;
+        return;
+    }
+    if (needsBind(activeUnit, static_cast<GLuint>(unit)))
+        gl->glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(unit));
+    textures[unit] = texture;
+    issuedCount++;
+    gl->glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    if (needsBind(bufferSlot(target), buffer))
+        gl->glBindBuffer(target, buffer);
+}
+
+void GLStateCache::bindBufferBase(GLuint index, GLuint buffer)
+{
+    if (needsRange(index, buffer, 0, -1))
+    {
+        gl->glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        // Indexed binds also replace the generic binding
+        uniformBuffer = buffer;
+    }
+}
+
+void GLStateCache::bindBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (needsRange(index, buffer, offset, size))
+    {
+        gl->glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+        uniformBuffer = buffer;
+    }
+}
+
+void GLStateCache::setPrimitiveRestart(bool enabled, GLuint index)
+{
+    if (needsBind(restartEnabled, enabled ? 1 : 0))
+    {
+        if (enabled)
+            gl->glEnable(GL_PRIMITIVE_RESTART);
+        else
+            gl->glDisable(GL_PRIMITIVE_RESTART);
+    }
+    if (enabled && needsBind(restartIndex, index))
+        gl->glPrimitiveRestartIndex(index);
+}
+
+void GLStateCache::resetCounters()
+{
+    issuedCount = elidedCount = 0;
+}
+
+int GLStateCache::issued() const
+{
+    return issuedCount;
+}
+
+int GLStateCache::elided() const
+{
+    return elidedCount;
+}
@@ -0,0 +1,65 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <QOpenGLFunctions_4_5_Core>
+
+// Shadow copy of the bindings of one context, binds matching the known state are skipped.
+// Anything else binding in that context (QPainter, Qt recreating the widget's framebuffer,
+// QOpenGLBuffer::bind) must be followed by invalidate()
+class GLStateCache
+{
+public:
+    static const int textureUnits = 8;
+    static const int uniformBindings = 8;
+
+    explicit GLStateCache(QOpenGLFunctions_4_5_Core *gl);
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // GL_TEXTURE_2D on the given unit
+    void bindTexture(int unit, GLuint texture);
+    // GL_ARRAY_BUFFER or GL_UNIFORM_BUFFER, the element buffer belongs to the vertex array
+    void bindBuffer(GLenum target, GLuint buffer);
+    // Indexed GL_UNIFORM_BUFFER bindings
+    void bindBufferBase(GLuint index, GLuint buffer);
+    void bindBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    // GL_PRIMITIVE_RESTART and its index, the index is only set while enabled
+    void setPrimitiveRestart(bool enabled, GLuint index = 0);
+
+    // Forgets every binding, the next bind of each kind is issued
+    void invalidate();
+
+    void resetCounters();
+    int issued() const;
+    int elided() const;
+
+private:
+    static const GLuint unknown = ~0u;
+
+    struct Range
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;    // -1 for a whole buffer binding
+    };
+
+    bool needsBind(GLuint &known, GLuint value);
+    bool needsRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    GLuint &bufferSlot(GLenum target);
+
+    QOpenGLFunctions_4_5_Core *gl;
+    GLuint program;
+    GLuint vao;
+    GLuint activeUnit;
+    GLuint textures[textureUnits];
+    GLuint arrayBuffer;
+    GLuint uniformBuffer;
+    GLuint otherBuffer;
+    Range ranges[uniformBindings];
+    GLuint restartEnabled;
+    GLuint restartIndex;
+    int issuedCount;
+    int elidedCount;
+};
+
+#endif // GLSTATECACHE_H
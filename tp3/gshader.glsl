@@ -0,0 +1,33 @@
+#version 330
+
+// Only used by the WIREFRAME variants : gives each corner of a triangle its
+// barycentric coordinate, the fragment shader draws the edges in the fill pass
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+#ifdef TEXTURED
+in vec2 g_texcoord[];
+out vec2 v_texcoord;
+#endif
+in vec4 g_color[];
+out vec4 v_color;
+
+// Interpolated in screen space so the lines keep a constant width
+noperspective out vec3 v_barycentric;
+
+void main()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Position = gl_in[i].gl_Position;
+#ifdef TEXTURED
+        v_texcoord = g_texcoord[i];
+#endif
+        v_color = g_color[i];
+        v_barycentric = vec3(0.0);
+        v_barycentric[i] = 1.0;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,161 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include "heightlayout.h"
+
+#include <QImage>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+
+// How a sample type is read from the 8 bit grey of an image (QImage has no 16 bit grey
+// before Qt 5.13) and brought back to [0, 1]
+template <typename SampleT>
+struct SampleFormat;
+
+template <>
+struct SampleFormat<quint8>
+{
+    static constexpr float normalize = 1.f / 255.f;
+
+    static quint8 fromGrey(quint8 grey) { return grey; }
+    static quint8 encode(float normalized) { return static_cast<quint8>(qBound(0.f, normalized, 1.f) * 255.f + .5f); }
+};
+
+template <>
+struct SampleFormat<quint16>
+{
+    static constexpr float normalize = 1.f / 65535.f;
+
+    static quint16 fromGrey(quint8 grey) { return static_cast<quint16>(grey * 257); }
+    static quint16 encode(float normalized) { return static_cast<quint16>(qBound(0.f, normalized, 1.f) * 65535.f + .5f); }
+};
+
+// Stored normalized
+template <>
+struct SampleFormat<float>
+{
+    static constexpr float normalize = 1.f;
+
+    static float fromGrey(quint8 grey) { return grey / 255.f; }
+    static float encode(float normalized) { return normalized; }
+};
+
+// Height = normalized sample * scale + bias, given as constants so they fold into the lookups
+struct UnitRange
+{
+    static constexpr float scale = 1.f;
+    static constexpr float bias = 0.f;
+};
+
+// Samples owned in a vector or borrowed from memory that outlives the store (a mapped file).
+// Only owned samples can be written, the non-const accessors of a borrowed store are null
+template <typename T>
+class SampleStore
+{
+public:
+    SampleStore() : borrowed(nullptr), count(0) {}
+    explicit SampleStore(size_t count) : owned(count), borrowed(nullptr), count(count) {}
+    SampleStore(const T *memory, size_t count) : borrowed(memory), count(count) {}
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    T *data() { return owned.data(); }
+    const T *data() const { return borrowed != nullptr ? borrowed : owned.data(); }
+    const T &operator[](size_t i) const { return data()[i]; }
+    T &operator[](size_t i) { return owned[i]; }
+
+private:
+    std::vector<T> owned;
+    const T *borrowed;
+    size_t count;
+};
+
+// Storage offsets of the four samples around (u, v) and the weights between them
+struct BilinearTaps
+{
+    size_t offsets[4];  // (x0, y0), (x1, y0), (x0, y1), (x1, y1)
+    float tx;
+    float ty;
+};
+
+// Grid of height samples. The sample type, the layout and the range are template parameters :
+// every lookup is specialised at compile time, loops over it carry no format or layout branch
+template <typename SampleT, typename Layout = RowMajorLayout, typename Range = UnitRange>
+class HeightField
+{
+public:
+    using Format = SampleFormat<SampleT>;
+
+    HeightField() : grid(0, 0) {}
+    HeightField(int width, int height) : grid(width, height), samples(grid.size()) {}
+    // Read-only view of samples already in layout order, they must outlive the field
+    HeightField(int width, int height, const SampleT *memory) : grid(width, height), samples(memory, grid.size()) {}
+
+    // Heights from the grey levels of the image, qGray of each pixel
+    explicit HeightField(const QImage &image) : HeightField(image.width(), image.height())
+    {
+        const QImage grey = image.convertToFormat(QImage::Format_Grayscale8);
+        for (int y = 0; y < height(); y++)
+        {
+            const quint8 *line = grey.constScanLine(y);
+            for (int x = 0; x < width(); x++)
+                samples[grid.offset(x, y)] = Format::fromGrey(line[x]);
+        }
+    }
+
+    // Same heights in another sample type, layout or range
+    template <typename Field>
+    explicit HeightField(const Field &source) : HeightField(source.width(), source.height())
+    {
+        for (int y = 0; y < height(); y++)
+            for (int x = 0; x < width(); x++)
+                samples[grid.offset(x, y)] = Format::encode((source.at(x, y) - Range::bias) / Range::scale);
+    }
+
+    bool isNull() const { return samples.empty(); }
+    int width() const { return grid.width; }
+    int height() const { return grid.height; }
+    const Layout &layout() const { return grid; }
+    // Raw samples in layout order. Writable only when the field owns them : null on a view
+    SampleT *data() { return samples.data(); }
+    const SampleT *data() const { return samples.data(); }
+
+    float at(int x, int y) const { return decode(samples[grid.offset(x, y)]); }
+
+    // u, v in [0, 1] from the north-west corner, samples sit on the grid nodes :
+    // u = 0 and u = 1 are the first and last columns
+    BilinearTaps bilinearTaps(float u, float v) const
+    {
+        float fx = qBound(0.f, u, 1.f) * (grid.width - 1);
+        float fy = qBound(0.f, v, 1.f) * (grid.height - 1);
+        int x0 = std::min(static_cast<int>(fx), std::max(grid.width - 2, 0));
+        int y0 = std::min(static_cast<int>(fy), std::max(grid.height - 2, 0));
+        BilinearTaps taps;
+        grid.quad(x0, y0, grid.width > 1 ? 1 : 0, grid.height > 1 ? 1 : 0, taps.offsets);
+        taps.tx = fx - x0;
+        taps.ty = fy - y0;
+        return taps;
+    }
+
+    float bilinear(float u, float v) const
+    {
+        BilinearTaps taps = bilinearTaps(u, v);
+        const SampleT *s = samples.data();
+        float h00 = decode(s[taps.offsets[0]]);
+        float h10 = decode(s[taps.offsets[1]]);
+        float h01 = decode(s[taps.offsets[2]]);
+        float h11 = decode(s[taps.offsets[3]]);
+        float top = h00 + (h10 - h00) * taps.tx;
+        float bottom = h01 + (h11 - h01) * taps.tx;
+        return top + (bottom - top) * taps.ty;
+    }
+
+private:
+    static float decode(SampleT sample) { return sample * (Format::normalize * Range::scale) + Range::bias; }
+
+    Layout grid;
+    SampleStore<SampleT> samples;
+};
+
+#endif // HEIGHTFIELD_H
@@ -0,0 +1,261 @@
+#include "heightpyramid.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Below this many rows a level isn't worth a thread
+    const int rowsPerTask = 32;
+
+    int reducedSize(int size)
+    {
+        return size > 1 ? (size - 1) / 2 + 1 : 1;
+    }
+
+    // column[x] = (above[x] + 2 * row[x] + below[x]) / 4
+    void filterColumns(const float *above, const float *row, const float *below, float *column, int width)
+    {
+        int x = 0;
+#ifdef __SSE2__
+        const __m128 quarter = _mm_set1_ps(.25f);
+        const __m128 half = _mm_set1_ps(.5f);
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 sides = _mm_add_ps(_mm_loadu_ps(above + x), _mm_loadu_ps(below + x));
+            __m128 sum = _mm_add_ps(_mm_mul_ps(sides, quarter), _mm_mul_ps(_mm_loadu_ps(row + x), half));
+            _mm_storeu_ps(column + x, sum);
+        }
+#endif
+        for (; x < width; x++)
+            column[x] = .25f * (above[x] + below[x]) + .5f * row[x];
+    }
+
+    // target[x] = (column[2x - 1] + 2 * column[2x] + column[2x + 1]) / 4, clamped at the borders
+    void decimateRow(const float *column, int width, float *target, int targetWidth)
+    {
+        auto tent = [&](int x)
+        {
+            int sx = 2 * x;
+            return .25f * (column[std::max(sx - 1, 0)] + column[std::min(sx + 1, width - 1)]) + .5f * column[sx];
+        };
+
+        target[0] = tent(0);
+        int x = 1;
+#ifdef __SSE2__
+        const __m128 quarter = _mm_set1_ps(.25f);
+        const __m128 half = _mm_set1_ps(.5f);
+        // Four outputs read column[2x - 1] to column[2x + 7]
+        for (; x + 4 <= targetWidth && 2 * x + 7 < width; x += 4)
+        {
+            const float *c = column + 2 * x;
+            __m128 low = _mm_loadu_ps(c);
+            __m128 high = _mm_loadu_ps(c + 4);
+            __m128 even = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+            __m128 previousOdd = _mm_shuffle_ps(_mm_loadu_ps(c - 1), _mm_loadu_ps(c + 3), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_add_ps(odd, previousOdd), quarter), _mm_mul_ps(even, half));
+            _mm_storeu_ps(target + x, sum);
+        }
+#endif
+        for (; x < targetWidth; x++)
+            target[x] = tent(x);
+    }
+
+    // Leaf corners in the order QuadNode::iteration() emits them : NW, NE, SW, SE
+    template <typename Visit>
+    void walkZOrder(float u, float v, float extent, int depth, Visit &visit)
+    {
+        if (depth == 0)
+        {
+            visit(u, v);
+            visit(u + extent, v);
+            visit(u, v + extent);
+            visit(u + extent, v + extent);
+            return;
+        }
+        float half = extent / 2.f;
+        walkZOrder(u, v, half, depth - 1, visit);
+        walkZOrder(u + half, v, half, depth - 1, visit);
+        walkZOrder(u, v + half, half, depth - 1, visit);
+        walkZOrder(u + half, v + half, half, depth - 1, visit);
+    }
+
+    // Set associative cache of 64 byte lines with LRU replacement
+    class CacheModel
+    {
+    public:
+        CacheModel(size_t bytes, int ways)
+            : ways(ways), sets(bytes / 64 / ways), tags(sets * ways, ~size_t(0)), misses(0) {}
+
+        void access(size_t address)
+        {
+            size_t line = address / 64;
+            size_t *set = &tags[(line % sets) * ways];
+            int hit = 0;
+            while (hit < ways && set[hit] != line)
+                hit++;
+            if (hit == ways)
+            {
+                misses++;
+                hit = ways - 1;
+            }
+            // Most recent first
+            std::memmove(set + 1, set, hit * sizeof(size_t));
+            set[0] = line;
+        }
+
+        size_t missCount() const { return misses; }
+
+    private:
+        int ways;
+        size_t sets;
+        std::vector<size_t> tags;
+        size_t misses;
+    };
+
+    template <typename Field>
+    void benchmarkLayout(const char *name, const Field &heights, int depth)
+    {
+        float sum = 0.f;
+        auto lookup = [&](float u, float v) { sum += heights.bilinear(u, v); };
+        int64_t start = Profiler::now();
+        walkZOrder(0.f, 0.f, 1.f, depth, lookup);
+        int64_t elapsed = Profiler::now() - start;
+
+        CacheModel l1(32 << 10, 8);
+        CacheModel l2(1 << 20, 16);
+        auto count = [&](float u, float v)
+        {
+            BilinearTaps taps = heights.bilinearTaps(u, v);
+            for (size_t offset : taps.offsets)
+            {
+                l1.access(offset * sizeof(*heights.data()));
+                l2.access(offset * sizeof(*heights.data()));
+            }
+        };
+        walkZOrder(0.f, 0.f, 1.f, depth, count);
+
+        std::cout << name << " : " << elapsed / 1e6 << " ms, misses 32 KiB " << l1.missCount()
+                  << ", 1 MiB " << l2.missCount() << " (checksum " << sum << ")" << std::endl;
+    }
+}
+
+void HeightPyramid::build(const HeightField<float> &heights)
+{
+    PROFILE_ZONE("HeightPyramid::build");
+    levels.clear();
+    if (heights.isNull())
+        return;
+
+    levels.emplace_back(heights);
+
+    // Reduced from the rows, the SIMD filters read them contiguously
+    Rows base = heights;
+    while (base.width() > 1 || base.height() > 1)
+    {
+        Rows next(reducedSize(base.width()), reducedSize(base.height()));
+        reduce(base, next);
+        levels.emplace_back(next);
+        base = std::move(next);
+    }
+}
+
+void HeightPyramid::setLevels(std::vector<Level> reduced)
+{
+    levels = std::move(reduced);
+}
+
+void HeightPyramid::reduce(const Rows &source, Rows &target)
+{
+    // Bands of rows on the pool threads, the last one on ours
+    int tasks = std::min(static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)),
+                         std::max(target.height() / rowsPerTask, 1));
+    int rows = (target.height() + tasks - 1) / tasks;
+    std::vector<std::future<void>> bands;
+    for (int first = 0; first < target.height(); first += rows)
+    {
+        int last = std::min(first + rows, target.height());
+        if (last == target.height())
+            reduceRows(source, target, first, last);
+        else
+            bands.push_back(std::async(std::launch::async, reduceRows, std::cref(source), std::ref(target), first, last));
+    }
+    for (std::future<void> &band : bands)
+        band.wait();
+}
+
+void HeightPyramid::reduceRows(const Rows &source, Rows &target, int firstRow, int lastRow)
+{
+    const RowMajorLayout &from = source.layout();
+    const RowMajorLayout &to = target.layout();
+    std::vector<float> column(static_cast<size_t>(from.width));
+    for (int y = firstRow; y < lastRow; y++)
+    {
+        int sy = 2 * y;
+        const float *row = source.data() + from.offset(0, sy);
+        const float *above = source.data() + from.offset(0, std::max(sy - 1, 0));
+        const float *below = source.data() + from.offset(0, std::min(sy + 1, from.height - 1));
+        filterColumns(above, row, below, column.data(), from.width);
+        decimateRow(column.data(), from.width, target.data() + to.offset(0, y), to.width);
+    }
+}
+
+bool HeightPyramid::isNull() const
+{
+    return levels.empty();
+}
+
+int HeightPyramid::levelCount() const
+{
+    return static_cast<int>(levels.size());
+}
+
+const HeightPyramid::Level &HeightPyramid::level(int index) const
+{
+    return levels[static_cast<size_t>(index)];
+}
+
+float HeightPyramid::sampleLevel(int level, float u, float v) const
+{
+    return levels[static_cast<size_t>(std::min(std::max(level, 0), levelCount() - 1))].bilinear(u, v);
+}
+
+float HeightPyramid::sample(float u, float v, float footprint) const
+{
+    // Level l spans 2^l full resolution texels, fractional levels blend to avoid popping
+    float lod = std::log2(std::max(footprint, 1.f));
+    int level = static_cast<int>(lod);
+    if (level >= levelCount() - 1)
+        return sampleLevel(levelCount() - 1, u, v);
+    float blend = lod - level;
+    float fine = sampleLevel(level, u, v);
+    if (blend <= 0.f)
+        return fine;
+    return fine + (sampleLevel(level + 1, u, v) - fine) * blend;
+}
+
+void HeightPyramid::benchmark(int size)
+{
+    size = std::max(size, 2);
+    Rows rows(size, size);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            rows.data()[rows.layout().offset(x, y)] = std::sin(x * .01f) * std::cos(y * .013f);
+    Level tiled(rows);
+
+    // Leaves about 4 texels wide, the finest the tree builds near the focus point
+    int depth = std::max(static_cast<int>(std::log2((size - 1) / 4.f)), 1);
+    std::cout << "heights " << size << " x " << size << ", " << (4ll << (2 * depth)) << " leaf corners in Z order" << std::endl;
+    benchmarkLayout("row-major", rows, depth);
+    benchmarkLayout("tiled    ", tiled, depth);
+}
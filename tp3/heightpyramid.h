@@ -0,0 +1,42 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+#include "heightfield.h"
+
+#include <vector>
+
+// Pre-filtered mip chain of the decoded heights. Each level halves the previous one with a
+// [1 2 1] / 4 tent, keeping the samples of a 2^n + 1 grid on the same terrain positions.
+// Levels are reduced row by row, then stored in 8 x 8 tiles for the quadtree's Z order walk
+class HeightPyramid
+{
+public:
+    using Level = HeightField<float, TiledLayout>;
+
+    // The levels are reduced on every core
+    void build(const HeightField<float> &heights);
+    // Levels already reduced, from a baked terrain
+    void setLevels(std::vector<Level> reduced);
+    bool isNull() const;
+    int levelCount() const;
+    const Level &level(int index) const;
+
+    // u, v in [0, 1] from the north-west corner. Bilinear inside the level
+    float sampleLevel(int level, float u, float v) const;
+    // Level matching a footprint given in full resolution texels, blended with the next one
+    float sample(float u, float v, float footprint) const;
+
+    // Times the leaf corner lookups of a size x size grid walked in Z order, row-major against
+    // tiled, and counts the misses of a simulated cache. Run with tp3 --bench-heights <size>
+    static void benchmark(int size);
+
+private:
+    using Rows = HeightField<float>;
+
+    static void reduce(const Rows &source, Rows &target);
+    static void reduceRows(const Rows &source, Rows &target, int firstRow, int lastRow);
+
+    std::vector<Level> levels;
+};
+
+#endif // HEIGHTPYRAMID_H
@@ -0,0 +1,202 @@
+#include "horizonculler.h"
+#include "terrainquery.h"
+#include "profiler.h"
+
+#include <QVector4D>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+    // Horizontal distances : along a ray they only grow, the nearer ground is crossed first
+    float nearDistance(const TerrainChunk &chunk, const QVector3D &eye)
+    {
+        float dx = std::max(std::max(chunk.min.x() - eye.x(), eye.x() - chunk.max.x()), 0.f);
+        float dy = std::max(std::max(chunk.min.y() - eye.y(), eye.y() - chunk.max.y()), 0.f);
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    float farDistance(const TerrainChunk &chunk, const QVector3D &eye)
+    {
+        float dx = std::max(std::abs(chunk.min.x() - eye.x()), std::abs(chunk.max.x() - eye.x()));
+        float dy = std::max(std::abs(chunk.min.y() - eye.y()), std::abs(chunk.max.y() - eye.y()));
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    // Screen column i spans edges i and i + 1
+    float edgeX(int edge)
+    {
+        return -1.f + 2.f * edge / HorizonCuller::columns;
+    }
+
+    float toColumns(float x)
+    {
+        return (x + 1.f) * .5f * HorizonCuller::columns;
+    }
+
+    // Heights where the vertical line at x crosses the convex hull of the points,
+    // false when it misses it
+    bool hullSpan(const float px[8], const float py[8], float x, float &low, float &high)
+    {
+        low = FLT_MAX;
+        high = -FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            for (int j = i + 1; j < 8; j++)
+            {
+                float a = px[i] - x;
+                float b = px[j] - x;
+                if (a * b > 0.f)
+                    continue;
+                float y0 = py[i];
+                float y1 = py[j];
+                if (a != b)
+                    y0 = y1 = py[i] + a / (a - b) * (py[j] - py[i]);
+                low = std::min(low, std::min(y0, y1));
+                high = std::max(high, std::max(y0, y1));
+            }
+        }
+        return low <= high;
+    }
+}
+
+HorizonCuller::HorizonCuller() : culled(0), culledTris(0)
+{
+}
+
+void HorizonCuller::cull(const std::vector<TerrainChunk> &chunks, const QMatrix4x4 &mvp, const QVector3D &eye, std::vector<int> &visible)
+{
+    PROFILE_ZONE("HorizonCuller::cull");
+    visible.clear();
+    culled = culledTris = 0;
+    for (Column &column : horizon)
+        column.covered = false;
+
+    float floorZ = FLT_MAX;
+    float topZ = -FLT_MAX;
+    for (const TerrainChunk &chunk : chunks)
+    {
+        floorZ = std::min(floorZ, chunk.min.z());
+        topZ = std::max(topZ, chunk.max.z());
+    }
+    // Below the ground or beside it, the boxes under the chunks can be seen from their sides
+    bool occluding = !chunks.empty()
+            && (eye.z() > topZ
+                || (TerrainQuery::isReady() && TerrainQuery::contains(eye.x(), eye.y()) && eye.z() > TerrainQuery::heightAt(eye.x(), eye.y())));
+
+    order.clear();
+    for (size_t i = 0; i < chunks.size(); i++)
+        order.emplace_back(nearDistance(chunks[i], eye), static_cast<int>(i));
+    std::sort(order.begin(), order.end());
+
+    float x[8];
+    float y[8];
+    for (const std::pair<float, int> &entry : order)
+    {
+        const TerrainChunk &chunk = chunks[static_cast<size_t>(entry.second)];
+        // Out of the screen or hidden by the ground drawn so far
+        if (project(mvp, chunk.min, chunk.max, x, y)
+                && (isOffScreen(x, y) || (occluding && isHidden(x, y, entry.first))))
+        {
+            culled++;
+            culledTris += static_cast<int>(chunk.indexCount / 3);
+            continue;
+        }
+        visible.push_back(entry.second);
+        if (occluding && project(mvp, QVector3D(chunk.min.x(), chunk.min.y(), floorZ), QVector3D(chunk.max.x(), chunk.max.y(), chunk.min.z()), x, y))
+            addOccluder(x, y, farDistance(chunk, eye));
+    }
+    std::sort(visible.begin(), visible.end());
+}
+
+int HorizonCuller::culledChunks() const
+{
+    return culled;
+}
+
+int HorizonCuller::culledTriangles() const
+{
+    return culledTris;
+}
+
+bool HorizonCuller::project(const QMatrix4x4 &mvp, const QVector3D &min, const QVector3D &max, float x[8], float y[8])
+{
+    for (int i = 0; i < 8; i++)
+    {
+        QVector4D clip = mvp * QVector4D(i & 1 ? max.x() : min.x(), i & 2 ? max.y() : min.y(), i & 4 ? max.z() : min.z(), 1.f);
+        if (clip.w() <= 1e-6f)
+            return false;
+        x[i] = clip.x() / clip.w();
+        y[i] = clip.y() / clip.w();
+    }
+    return true;
+}
+
+bool HorizonCuller::isOffScreen(const float x[8], const float y[8])
+{
+    return *std::max_element(x, x + 8) < -1.f || *std::min_element(x, x + 8) > 1.f
+        || *std::max_element(y, y + 8) < -1.f || *std::min_element(y, y + 8) > 1.f;
+}
+
+bool HorizonCuller::isHidden(const float x[8], const float y[8], float nearDist) const
+{
+    // Only the part on screen has to be hidden
+    float low = std::max(*std::min_element(y, y + 8), -1.f);
+    float high = std::min(*std::max_element(y, y + 8), 1.f);
+    int first = std::max(static_cast<int>(std::floor(toColumns(*std::min_element(x, x + 8)))), 0);
+    int last = std::min(static_cast<int>(std::floor(toColumns(*std::max_element(x, x + 8)))), columns - 1);
+    for (int i = first; i <= last; i++)
+    {
+        const Column &column = horizon[i];
+        if (!column.covered || column.low > low || column.high < high || column.reach > nearDist)
+            return false;
+    }
+    return true;
+}
+
+void HorizonCuller::cover(Column &column, float low, float high, float reach)
+{
+    if (!column.covered)
+        column = { true, low, high, reach };
+    // Already hidden by nearer ground : keeping the nearer reach lets more chunks pass
+    else if (low >= column.low && high <= column.high)
+        return;
+    else if (low <= column.high && high >= column.low)
+    {
+        // Overlapping spans : their union is hidden as far as the farthest
+        column.low = std::min(column.low, low);
+        column.high = std::max(column.high, high);
+        column.reach = std::max(column.reach, reach);
+    }
+    // One span per column : keep the taller
+    else if (high - low > column.high - column.low)
+        column = { true, low, high, reach };
+}
+
+void HorizonCuller::addOccluder(const float x[8], const float y[8], float farDist)
+{
+    // Columns whose two edges cross the projection : between them the spans common to both
+    // edges are inside it, the projection of a box is convex
+    int first = std::max(static_cast<int>(std::ceil(toColumns(*std::min_element(x, x + 8)))), 0);
+    int last = std::min(static_cast<int>(std::floor(toColumns(*std::max_element(x, x + 8)))), columns);
+    float previousLow = 0.f;
+    float previousHigh = 0.f;
+    bool previous = false;
+    for (int edge = first; edge <= last; edge++)
+    {
+        float edgeLow;
+        float edgeHigh;
+        bool crossed = hullSpan(x, y, edgeX(edge), edgeLow, edgeHigh);
+        if (crossed && previous)
+        {
+            float low = std::max(edgeLow, previousLow);
+            float high = std::min(edgeHigh, previousHigh);
+            if (low < high)
+                cover(horizon[edge - 1], low, high, farDist);
+        }
+        previous = crossed;
+        previousLow = edgeLow;
+        previousHigh = edgeHigh;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef HORIZONCULLER_H
+#define HORIZONCULLER_H
+
+#include "geometryengine.h"
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <vector>
+
+// Conservative occlusion of the terrain chunks seen from above the ground. The chunks are
+// walked nearest first while a 1D horizon buffer of screen columns records, for each one, the
+// span of screen heights already hidden by the nearer ones. A chunk whose whole projection
+// falls inside the spans of its columns is behind drawn ground and skipped.
+// Occluders are the solid boxes under the lowest point of each drawn chunk : from an eye
+// above the surface, any ray reaching them crossed the ground before. Chunks out of the
+// screen are skipped as well
+class HorizonCuller
+{
+public:
+    static const int columns = 64;
+
+    HorizonCuller();
+
+    // Indices of the chunks to draw, ascending : neighbours stay contiguous for drawChunks().
+    // mvp maps terrain coordinates to clip space, eye is the camera in terrain coordinates
+    void cull(const std::vector<TerrainChunk> &chunks, const QMatrix4x4 &mvp, const QVector3D &eye, std::vector<int> &visible);
+
+    // Of the last cull()
+    int culledChunks() const;
+    int culledTriangles() const;
+
+private:
+    // Screen heights low to high hidden over the whole column by ground at most reach away
+    struct Column
+    {
+        bool covered;
+        float low;
+        float high;
+        float reach;
+    };
+
+    // Normalized device coordinates of the corners of a box, false when one is behind the eye
+    static bool project(const QMatrix4x4 &mvp, const QVector3D &min, const QVector3D &max, float x[8], float y[8]);
+
+    static bool isOffScreen(const float x[8], const float y[8]);
+    static void cover(Column &column, float low, float high, float reach);
+
+    bool isHidden(const float x[8], const float y[8], float nearDist) const;
+    void addOccluder(const float x[8], const float y[8], float farDist);
+
+    Column horizon[columns];
+    std::vector<std::pair<float, int>> order;
+    int culled;
+    int culledTris;
+};
+
+#endif // HORIZONCULLER_H
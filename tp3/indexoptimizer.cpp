@@ -0,0 +1,310 @@
+#include "indexoptimizer.h"
+#include "geometryengine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+    // FIFO cache simulation, returns the number of vertices that had to be transformed
+    class FifoCache
+    {
+    public:
+        FifoCache(unsigned int vertexCount, int size) : stamps(vertexCount, 0), size(size), time(0), misses(0) {}
+
+        void access(GLuint vertex)
+        {
+            // A vertex is still cached if fewer than size misses happened since its own
+            if (stamps[vertex] == 0 || time - stamps[vertex] >= static_cast<unsigned int>(size))
+            {
+                time++;
+                stamps[vertex] = time;
+                misses++;
+            }
+        }
+
+        unsigned int missCount() const { return misses; }
+
+    private:
+        std::vector<unsigned int> stamps;
+        int size;
+        unsigned int time;
+        unsigned int misses;
+    };
+
+    // Forsyth's scoring constants
+    const float cacheDecayPower = 1.5f;
+    const float lastTriangleScore = .75f;
+    const float valenceBoostScale = 2.f;
+    const float valenceBoostPower = .5f;
+    const int maxCacheSize = 64;
+    const int maxValence = 32;
+
+    // Scores only depend on small integers : tabulated once per call, no pow() in the loop
+    class ScoreTable
+    {
+    public:
+        explicit ScoreTable(int cacheSize)
+        {
+            for (int i = 0; i < maxCacheSize; i++)
+            {
+                // The three vertices of the last triangle score the same, whatever order they went in
+                if (i < 3)
+                    position[i] = lastTriangleScore;
+                else if (i < cacheSize)
+                    position[i] = std::pow(1.f - static_cast<float>(i - 3) / (cacheSize - 3), cacheDecayPower);
+                else
+                    position[i] = 0.f;
+            }
+            // Favour vertices with few triangles left, so they don't get stranded
+            valence[0] = 0.f;
+            for (int i = 1; i <= maxValence; i++)
+                valence[i] = valenceBoostScale * std::pow(static_cast<float>(i), -valenceBoostPower);
+        }
+
+        float operator()(int cachePosition, int activeTriangles) const
+        {
+            // No triangle left to draw with this vertex
+            if (activeTriangles == 0)
+                return -1.f;
+            return (cachePosition >= 0 ? position[cachePosition] : 0.f) + valence[std::min(activeTriangles, maxValence)];
+        }
+
+    private:
+        float position[maxCacheSize];
+        float valence[maxValence + 1];
+    };
+
+    struct VertexKey
+    {
+        float values[5];
+
+        bool operator==(const VertexKey &other) const
+        {
+            return std::memcmp(values, other.values, sizeof(values)) == 0;
+        }
+    };
+
+    struct VertexKeyHash
+    {
+        size_t operator()(const VertexKey &key) const
+        {
+            uint32_t bits[5];
+            std::memcpy(bits, key.values, sizeof(bits));
+            size_t hash = 2166136261u;
+            for (uint32_t b : bits)
+                hash = (hash ^ b) * 16777619u;
+            return hash;
+        }
+    };
+}
+
+float IndexOptimizer::acmr(const std::vector<GLuint> &indices, unsigned int vertexCount, int cacheSize)
+{
+    if (indices.size() < 3)
+        return 0.f;
+    FifoCache cache(vertexCount, cacheSize);
+    for (GLuint index : indices)
+        cache.access(index);
+    return static_cast<float>(cache.missCount()) / (indices.size() / 3);
+}
+
+float IndexOptimizer::acmrStrip(const std::vector<GLuint> &indices, unsigned int vertexCount, GLuint restartIndex, int cacheSize)
+{
+    FifoCache cache(vertexCount, cacheSize);
+    size_t triangles = 0;
+    size_t run = 0;
+    for (GLuint index : indices)
+    {
+        if (index == restartIndex)
+        {
+            run = 0;
+            continue;
+        }
+        cache.access(index);
+        // Every index after the first two of a run makes a triangle, degenerate ones included
+        if (++run >= 3)
+            triangles++;
+    }
+    return triangles > 0 ? static_cast<float>(cache.missCount()) / triangles : 0.f;
+}
+
+unsigned int IndexOptimizer::weldVertices(VertexData *vertices, unsigned int vertexCount, std::vector<GLuint> &indices)
+{
+    std::unordered_map<VertexKey, GLuint, VertexKeyHash> unique;
+    unique.reserve(vertexCount);
+    std::vector<GLuint> remap(vertexCount);
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        const VertexData &v = vertices[i];
+        VertexKey key = { { v.position.x(), v.position.y(), v.position.z(), v.texCoord.x(), v.texCoord.y() } };
+        auto inserted = unique.emplace(key, count);
+        if (inserted.second)
+            vertices[count++] = v;
+        remap[i] = inserted.first->second;
+    }
+
+    for (GLuint &index : indices)
+        index = remap[index];
+    return count;
+}
+
+void IndexOptimizer::optimizeVertexCache(std::vector<GLuint> &indices, unsigned int vertexCount, int cacheSize)
+{
+    cacheSize = std::min(std::max(cacheSize, 4), maxCacheSize);
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Triangles of each vertex, as one flat adjacency list
+    std::vector<int> active(vertexCount, 0);
+    for (GLuint index : indices)
+        active[index]++;
+    std::vector<size_t> offsets(vertexCount + 1, 0);
+    for (unsigned int v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + static_cast<size_t>(active[v]);
+    std::vector<GLuint> adjacency(indices.size());
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = static_cast<GLuint>(t);
+
+    const ScoreTable vertexScore(cacheSize);
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(-1, active[v]);
+
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    std::vector<GLuint> output;
+    output.reserve(indices.size());
+    GLuint cache[maxCacheSize + 3];
+    int cacheUsed = 0;
+    size_t scanFrom = 0;
+    long best = -1;
+
+    while (output.size() < indices.size())
+    {
+        if (best < 0)
+        {
+            // Nothing left around the cache : restart from the next triangle not drawn yet,
+            // which keeps the scan linear over the whole mesh
+            while (emitted[scanFrom])
+                scanFrom++;
+            best = static_cast<long>(scanFrom);
+        }
+
+        size_t t = static_cast<size_t>(best);
+        emitted[t] = true;
+        GLuint corners[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+
+        // Move the corners to the front of the cache, drop the triangle from their lists
+        GLuint newCache[maxCacheSize + 3];
+        int newUsed = 0;
+        for (GLuint v : corners)
+        {
+            output.push_back(v);
+            newCache[newUsed++] = v;
+            size_t end = offsets[v] + static_cast<size_t>(active[v]);
+            for (size_t i = offsets[v]; i < end; i++)
+            {
+                if (adjacency[i] == t)
+                {
+                    std::swap(adjacency[i], adjacency[end - 1]);
+                    active[v]--;
+                    break;
+                }
+            }
+        }
+        for (int i = 0; i < cacheUsed; i++)
+        {
+            GLuint v = cache[i];
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+                newCache[newUsed++] = v;
+        }
+
+        // Vertices pushed out of the cache lose their position score
+        for (int i = cacheSize; i < newUsed; i++)
+            cachePosition[newCache[i]] = -1;
+        cacheUsed = std::min(newUsed, cacheSize);
+        std::copy(newCache, newCache + cacheUsed, cache);
+
+        // Rescore what changed and pick the best triangle touching the cache
+        for (int i = 0; i < newUsed; i++)
+        {
+            GLuint v = newCache[i];
+            if (i < cacheUsed)
+                cachePosition[v] = i;
+            float delta = vertexScore(cachePosition[v], active[v]) - vertexScores[v];
+            vertexScores[v] += delta;
+            size_t end = offsets[v] + static_cast<size_t>(active[v]);
+            for (size_t j = offsets[v]; j < end; j++)
+                triangleScores[adjacency[j]] += delta;
+        }
+
+        best = -1;
+        float bestScore = -1.f;
+        for (int i = 0; i < cacheUsed; i++)
+        {
+            GLuint v = cache[i];
+            size_t end = offsets[v] + static_cast<size_t>(active[v]);
+            for (size_t j = offsets[v]; j < end; j++)
+            {
+                GLuint candidate = adjacency[j];
+                if (triangleScores[candidate] > bestScore)
+                {
+                    bestScore = triangleScores[candidate];
+                    best = static_cast<long>(candidate);
+                }
+            }
+        }
+    }
+    indices.swap(output);
+}
+
+void IndexOptimizer::optimizeVertexCacheRange(std::vector<GLuint> &indices, size_t first, size_t count, int cacheSize)
+{
+    // Vertices renumbered from 0 inside the range, the whole-buffer pass sizes its tables on them
+    std::unordered_map<GLuint, GLuint> local;
+    std::vector<GLuint> global;
+    std::vector<GLuint> range(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto inserted = local.emplace(indices[first + i], static_cast<GLuint>(global.size()));
+        if (inserted.second)
+            global.push_back(indices[first + i]);
+        range[i] = inserted.first->second;
+    }
+    optimizeVertexCache(range, static_cast<unsigned int>(global.size()), cacheSize);
+    for (size_t i = 0; i < count; i++)
+        indices[first + i] = global[range[i]];
+}
+
+unsigned int IndexOptimizer::optimizeVertexFetch(VertexData *vertices, unsigned int vertexCount, std::vector<GLuint> &indices)
+{
+    const GLuint unused = ~0u;
+    std::vector<GLuint> remap(vertexCount, unused);
+    std::vector<VertexData> ordered;
+    ordered.reserve(vertexCount);
+
+    for (GLuint &index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = static_cast<GLuint>(ordered.size());
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    // Vertices no triangle uses are dropped
+    std::copy(ordered.begin(), ordered.end(), vertices);
+    return static_cast<unsigned int>(ordered.size());
+}
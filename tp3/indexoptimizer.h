@@ -0,0 +1,29 @@
+#ifndef INDEXOPTIMIZER_H
+#define INDEXOPTIMIZER_H
+
+#include <QOpenGLFunctions>
+#include <vector>
+
+struct VertexData;
+
+// Post-transform vertex cache optimisation of the generated terrain meshes
+namespace IndexOptimizer
+{
+    // Average cache miss ratio : vertices transformed per triangle with a FIFO cache,
+    // 0.5 at best on a regular grid, 3 without any reuse
+    float acmr(const std::vector<GLuint> &indices, unsigned int vertexCount, int cacheSize = 16);
+    // Same for a triangle strip, restart indices and degenerate triangles included
+    float acmrStrip(const std::vector<GLuint> &indices, unsigned int vertexCount, GLuint restartIndex, int cacheSize = 16);
+
+    // Merges identical vertices in place and remaps the indices, returns the new vertex count
+    unsigned int weldVertices(VertexData *vertices, unsigned int vertexCount, std::vector<GLuint> &indices);
+    // Forsyth's linear-speed triangle reordering for a cache of cacheSize entries
+    void optimizeVertexCache(std::vector<GLuint> &indices, unsigned int vertexCount, int cacheSize = 32);
+    // Same for the count indices from first only, their triangles stay in that range
+    void optimizeVertexCacheRange(std::vector<GLuint> &indices, size_t first, size_t count, int cacheSize = 32);
+    // Renumbers the vertices in order of first use so fetches walk the buffer forward,
+    // returns the number of vertices still referenced
+    unsigned int optimizeVertexFetch(VertexData *vertices, unsigned int vertexCount, std::vector<GLuint> &indices);
+}
+
+#endif // INDEXOPTIMIZER_H
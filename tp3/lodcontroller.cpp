@@ -0,0 +1,117 @@
+#include "lodcontroller.h"
+#include "quadnode.h"
+
+#include <algorithm>
+#include <cmath>
+
+LodController::LodController()
+    : baseDepth(QuadNode::startDepth), baseMaxDist(QuadNode::maxDist), enabled(true), currentLevel(0),
+      target(0.f), cost(0.f), windowStart(0), cpuSum(0.f), gpuSum(0.f), over(0), under(0), settling(false),
+      detailRevision(0)
+{
+    clock.start();
+}
+
+LodController *LodController::instance()
+{
+    static LodController controller;
+    return &controller;
+}
+
+void LodController::addView(double fps)
+{
+    float ms = static_cast<float>(1000.0 / fps);
+    if (target == 0.f || ms < target)
+        target = ms;
+}
+
+void LodController::addFrame(float cpuBuildMs, float gpuMs)
+{
+    cpuSum += cpuBuildMs;
+    gpuSum += gpuMs;
+    qint64 now = clock.elapsed();
+    qint64 elapsed = now - windowStart;
+    if (elapsed < windowMs || target == 0.f)
+        return;
+
+    float sumCpu = cpuSum;
+    float sumGpu = gpuSum;
+    cpuSum = gpuSum = 0.f;
+    windowStart = now;
+    // Nothing was drawn for a while : the window says nothing about the load
+    if (elapsed > 4 * windowMs)
+        return;
+    // The processor and the graphics card work in parallel, the busier one sets the rate
+    cost = std::max(sumCpu, sumGpu) * target / elapsed;
+    if (!enabled)
+        return;
+    // The window of a change paid for the rebuild, and the GPU results lag two frames
+    if (settling)
+    {
+        settling = false;
+        return;
+    }
+
+    over = cost > highLoad * target ? over + 1 : 0;
+    under = cost < lowLoad * target ? under + 1 : 0;
+    if (over >= coarsenWindows && currentLevel < maxLevel())
+        setLevel(currentLevel + 1);
+    else if (under >= refineWindows && currentLevel > 0)
+        setLevel(currentLevel - 1);
+}
+
+bool LodController::isEnabled() const
+{
+    return enabled;
+}
+
+void LodController::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+    if (!enabled && currentLevel != 0)
+        setLevel(0);
+}
+
+int LodController::level() const
+{
+    return currentLevel;
+}
+
+int LodController::startDepth() const
+{
+    return baseDepth - currentLevel / 4;
+}
+
+float LodController::maxDist() const
+{
+    // Triangles grow as 4^startDepth * maxDist : one depth less is made up by 4 times the distance
+    return baseMaxDist * std::pow(.7f, static_cast<float>(currentLevel)) * static_cast<float>(1 << 2 * (currentLevel / 4));
+}
+
+float LodController::targetMs() const
+{
+    return target;
+}
+
+float LodController::costMs() const
+{
+    return cost;
+}
+
+unsigned int LodController::revision() const
+{
+    return detailRevision;
+}
+
+int LodController::maxLevel() const
+{
+    return std::max(4 * (baseDepth - minDepth) + 3, 0);
+}
+
+void LodController::setLevel(int level)
+{
+    currentLevel = level;
+    over = under = 0;
+    settling = true;
+    detailRevision++;
+}
@@ -0,0 +1,68 @@
+#ifndef LODCONTROLLER_H
+#define LODCONTROLLER_H
+
+#include <QElapsedTimer>
+
+// Closed loop on the cost of the terrain. The CPU build and GPU times of every view are summed
+// over windows of wall time : the views share the processor and the graphics card, what counts
+// is how much of each target frame they keep them busy. Over budget the detail steps down,
+// well under it steps back up to the configured detail. Each step multiplies the triangle
+// count by about 0.7 : QuadNode::maxDist first, the maximum depth every fourth step.
+// The two thresholds are further apart than a step and a move waits for several windows
+// in a row, so the detail settles instead of oscillating
+class LodController
+{
+public:
+    static const qint64 windowMs = 250;
+    static const int coarsenWindows = 2;
+    static const int refineWindows = 8;
+    // Fractions of the target frame time
+    static constexpr float highLoad = .9f;
+    static constexpr float lowLoad = .5f;
+    // The chunks of the HorizonCuller need the first levels
+    static const int minDepth = 4;
+
+    static LodController *instance();
+
+    // The fastest view sets the target frame time
+    void addView(double fps);
+    // Measured costs of a frame of any view
+    void addFrame(float cpuBuildMs, float gpuMs);
+
+    // Disabled, the configured detail is restored
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    // 0 is the configured detail, coarser above
+    int level() const;
+    int startDepth() const;
+    float maxDist() const;
+    float targetMs() const;
+    // Terrain time per target frame over the last window
+    float costMs() const;
+    // Changes whenever the detail does
+    unsigned int revision() const;
+
+private:
+    LodController();
+
+    int maxLevel() const;
+    void setLevel(int level);
+
+    const int baseDepth;
+    const float baseMaxDist;
+    bool enabled;
+    int currentLevel;
+    float target;
+    float cost;
+    QElapsedTimer clock;
+    qint64 windowStart;
+    float cpuSum;
+    float gpuSum;
+    int over;
+    int under;
+    bool settling;
+    unsigned int detailRevision;
+};
+
+#endif // LODCONTROLLER_H
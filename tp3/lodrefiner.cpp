@@ -0,0 +1,315 @@
+#include "lodrefiner.h"
+#include "quadnode.h"
+#include "profiler.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+LodRefiner::LodRefiner()
+    : cells(0), pending(0), queued(false), running(false), finished(false), stopping(false),
+      needed(0), notReady(0), totalNeeded(0), totalNotReady(0)
+{
+}
+
+LodRefiner::~LodRefiner()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
+
+void LodRefiner::adopt(const TerrainMesh &mesh)
+{
+    PROFILE_ZONE("LodRefiner::adopt");
+    clear();
+    const int grid = GeometryEngine::chunkCells();
+    if (mesh.chunks.size() != static_cast<size_t>(grid * grid))
+        return;
+
+    cells = grid;
+    parts.resize(mesh.chunks.size());
+    built.resize(mesh.chunks.size());
+    ahead.assign(mesh.chunks.size(), Prefetched{ -1, QVector3D(), Detail(), ChunkMesh() });
+    const float cellWidth = QuadNode::width / cells;
+    const float cellHeight = QuadNode::height / cells;
+    // Vertices of the whole mesh renumbered for the chunk they belong to
+    std::vector<GLuint> remap(mesh.vertices.size(), ~0u);
+    for (const TerrainChunk &chunk : mesh.chunks)
+    {
+        int x = qBound(0, static_cast<int>(((chunk.min.x() + chunk.max.x()) * .5f - QuadNode::startx) / cellWidth), cells - 1);
+        int y = qBound(0, static_cast<int>((QuadNode::starty - (chunk.min.y() + chunk.max.y()) * .5f) / cellHeight), cells - 1);
+        int index = y * cells + x;
+        ChunkMesh &part = parts[static_cast<size_t>(index)];
+        part.min = chunk.min;
+        part.max = chunk.max;
+        part.focus = mesh.focus;
+        part.acmrGenerated = mesh.acmrGenerated;
+        part.acmrDrawn = mesh.acmrDrawn;
+        part.indices.reserve(chunk.indexCount);
+        for (GLuint i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i++)
+        {
+            GLuint vertex = mesh.indices[i];
+            if (remap[vertex] == ~0u)
+            {
+                remap[vertex] = static_cast<GLuint>(part.vertices.size());
+                part.vertices.push_back(mesh.vertices[vertex]);
+            }
+            part.indices.push_back(remap[vertex]);
+        }
+        for (GLuint i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i++)
+            remap[mesh.indices[i]] = ~0u;
+        built[static_cast<size_t>(index)] = targetDetail(index, cells, mesh.focus);
+    }
+    // Every cell once, otherwise the mesh wasn't built by chunks
+    for (const ChunkMesh &part : parts)
+    {
+        if (part.indices.empty())
+        {
+            clear();
+            return;
+        }
+    }
+}
+
+void LodRefiner::clear()
+{
+    cancelPrefetch();
+    cells = 0;
+    parts.clear();
+    built.clear();
+    ahead.clear();
+    pending = needed = notReady = 0;
+}
+
+bool LodRefiner::isNull() const
+{
+    return parts.empty();
+}
+
+bool LodRefiner::refine(const QElapsedTimer &clock, qint64 budgetUs, bool optimizeIndices,
+                        const std::function<bool(int index, const ChunkMesh &chunk)> &place)
+{
+    // QuadNode::startDepth went under chunkDepth : the grid changed, adopt() a new mesh
+    if (isNull() || cells != GeometryEngine::chunkCells())
+        return false;
+    PROFILE_ZONE("LodRefiner::refine");
+    collectPrefetched();
+
+    queue.clear();
+    needed = notReady = 0;
+    for (int i = 0; i < cells * cells; i++)
+    {
+        Detail target = targetDetail(i, cells, QuadNode::p);
+        float error = detailError(target, built[static_cast<size_t>(i)]);
+        if (error <= settledError)
+            continue;
+        needed++;
+        if (!isPrefetched(i, target))
+            notReady++;
+        queue.emplace_back(error, i);
+    }
+    totalNeeded += needed;
+    totalNotReady += notReady;
+    std::sort(queue.begin(), queue.end(), std::greater<std::pair<float, int>>());
+
+    // Chunks built ahead only cost their upload
+    size_t done = 0;
+    while (done < queue.size() && (done == 0 || clock.nsecsElapsed() / 1000 < budgetUs))
+    {
+        const size_t index = static_cast<size_t>(queue[done++].second);
+        const int i = static_cast<int>(index);
+        Detail target = targetDetail(i, cells, QuadNode::p);
+        if (isPrefetched(i, target))
+        {
+            parts[index] = std::move(ahead[index].mesh);
+            built[index] = ahead[index].detail;
+            ahead[index].index = -1;
+        }
+        else
+        {
+            parts[index] = GeometryEngine::buildChunkMesh(i % cells, i / cells, optimizeIndices, QuadNode::p);
+            built[index] = target;
+        }
+        if (!place(i, parts[index]))
+            break;
+    }
+    pending = static_cast<int>(queue.size() - done);
+    return done > 0;
+}
+
+const std::vector<ChunkMesh> &LodRefiner::chunkMeshes() const
+{
+    return parts;
+}
+
+int LodRefiner::pendingChunks() const
+{
+    return pending;
+}
+
+void LodRefiner::prefetch(const std::vector<QVector3D> &path, bool optimizeIndices)
+{
+    if (isNull() || cells != GeometryEngine::chunkCells() || path.size() < 2)
+        return;
+    collectPrefetched();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (queued || running || finished)
+            return;
+
+        std::vector<Detail> aheadDetail(ahead.size(), Detail{ -1.f, -1.f });
+        for (size_t i = 0; i < ahead.size(); i++)
+            if (ahead[i].index >= 0)
+                aheadDetail[i] = ahead[i].detail;
+        job = PrefetchJob{ cells, built, std::move(aheadDetail), path, optimizeIndices };
+        queued = true;
+    }
+    // Started with the first job, lives until the destructor
+    if (!worker.joinable())
+        worker = std::thread(&LodRefiner::work, this);
+    wake.notify_one();
+}
+
+void LodRefiner::cancelPrefetch()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        queued = false;
+        wake.wait(guard, [this]() { return !running; });
+        finished = false;
+        results.clear();
+    }
+    ahead.assign(static_cast<size_t>(cells * cells), Prefetched{ -1, QVector3D(), Detail(), ChunkMesh() });
+}
+
+void LodRefiner::work()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        wake.wait(guard, [this]() { return queued || stopping; });
+        if (stopping)
+            return;
+        PrefetchJob current = std::move(job);
+        queued = false;
+        running = true;
+        guard.unlock();
+
+        std::vector<Prefetched> chunks = buildAhead(current.cells, std::move(current.built), std::move(current.ahead),
+                                                    std::move(current.path), current.optimizeIndices);
+
+        guard.lock();
+        results = std::move(chunks);
+        running = false;
+        finished = true;
+        // cancelPrefetch() may wait for it
+        wake.notify_all();
+    }
+}
+
+int LodRefiner::neededChunks() const
+{
+    return needed;
+}
+
+int LodRefiner::notReadyChunks() const
+{
+    return notReady;
+}
+
+qint64 LodRefiner::totalNeededChunks() const
+{
+    return totalNeeded;
+}
+
+qint64 LodRefiner::totalNotReadyChunks() const
+{
+    return totalNotReady;
+}
+
+void LodRefiner::collectPrefetched()
+{
+    std::vector<Prefetched> done;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!finished)
+            return;
+        done = std::move(results);
+        results.clear();
+        finished = false;
+    }
+    for (Prefetched &result : done)
+        ahead[static_cast<size_t>(result.index)] = std::move(result);
+}
+
+std::vector<LodRefiner::Prefetched> LodRefiner::buildAhead(int cells, std::vector<Detail> built, std::vector<Detail> ahead,
+                                                           std::vector<QVector3D> path, bool optimizeIndices)
+{
+    PROFILE_ZONE("LodRefiner::buildAhead");
+    QElapsedTimer clock;
+    clock.start();
+
+    // Each chunk at the first step of the path that moves it off its leaves, soonest first
+    std::vector<std::pair<int, int>> order;
+    for (int i = 0; i < cells * cells; i++)
+    {
+        for (size_t step = 1; step < path.size(); step++)
+        {
+            Detail target = targetDetail(i, cells, path[step]);
+            if (detailError(target, built[static_cast<size_t>(i)]) <= settledError)
+                continue;
+            // Already built ahead for it
+            if (detailError(target, ahead[static_cast<size_t>(i)]) > settledError)
+                order.emplace_back(static_cast<int>(step), i);
+            break;
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<Prefetched> results;
+    for (const std::pair<int, int> &entry : order)
+    {
+        if (clock.nsecsElapsed() / 1000 >= prefetchBudgetUs)
+            break;
+        const int index = entry.second;
+        const QVector3D &focus = path[static_cast<size_t>(entry.first)];
+        results.push_back({ index, focus, targetDetail(index, cells, focus),
+                            GeometryEngine::buildChunkMesh(index % cells, index / cells, optimizeIndices, focus) });
+    }
+    return results;
+}
+
+bool LodRefiner::isPrefetched(int index, const Detail &target) const
+{
+    const Prefetched &slot = ahead[static_cast<size_t>(index)];
+    return slot.index == index && detailError(target, slot.detail) <= settledError;
+}
+
+float LodRefiner::detailError(const Detail &a, const Detail &b)
+{
+    return std::max(std::abs(a.nearDepth - b.nearDepth), std::abs(a.farDepth - b.farDepth));
+}
+
+LodRefiner::Detail LodRefiner::targetDetail(int index, int cells, const QVector3D &focus)
+{
+    // Leaves stop splitting at depth startDepth - distance, see the QuadNode constructors,
+    // and never above the chunk node
+    const float sizeX = QuadNode::width / cells;
+    const float sizeY = QuadNode::height / cells;
+    const float x = QuadNode::startx + (index % cells) * sizeX;
+    const float y = QuadNode::starty - (index / cells) * sizeY;
+    float farX = std::max(std::abs(x - focus.x()), std::abs(x + sizeX - focus.x()));
+    float farY = std::max(std::abs(y - focus.y()), std::abs(y - sizeY - focus.y()));
+    const float top = static_cast<float>(QuadNode::startDepth);
+    const float chunk = std::log2(static_cast<float>(cells));
+    Detail detail;
+    detail.nearDepth = qBound(chunk, top - distance(focus, x, y, sizeX, sizeY), top);
+    detail.farDepth = qBound(chunk, top - (farX * farX + farY * farY) / QuadNode::maxDist, top);
+    return detail;
+}
@@ -0,0 +1,121 @@
+#ifndef LODREFINER_H
+#define LODREFINER_H
+
+#include "geometryengine.h"
+
+#include <QElapsedTimer>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rebuilds the chunks of the terrain a few at a time. Each chunk remembers the depths its
+// leaves were built for; those the focus point or the QuadNode parameters moved furthest
+// from are rebuilt first until the time budget of the frame is spent, the others keep their
+// previous leaves meanwhile. A jump of the focus point converges over a few frames instead
+// of stalling one. Along a predicted path of the focus point, a worker builds ahead the
+// chunks it will move off their target; refine() swaps them in for free when it gets there.
+// The worker is one thread for the life of the refiner, fed a job at a time
+class LodRefiner
+{
+public:
+    // Chunks closer than this many levels to their target are left as they are
+    static constexpr float settledError = .05f;
+    // Simulation steps predicted ahead, and time a prefetch job may spend on them
+    static const int lookahead = 30;
+    static const qint64 prefetchBudgetUs = 8000;
+
+    LodRefiner();
+    ~LodRefiner();
+
+    // Takes the chunks of a mesh built in one go. Null if they don't match the chunk grid
+    void adopt(const TerrainMesh &mesh);
+    void clear();
+    bool isNull() const;
+
+    // Rebuilds chunks, largest error first, and hands each one to place, until clock passes
+    // budgetUs : one at least. Stops early when place returns false. False when none changed
+    bool refine(const QElapsedTimer &clock, qint64 budgetUs, bool optimizeIndices,
+                const std::function<bool(int index, const ChunkMesh &chunk)> &place);
+    // Every chunk, row by row
+    const std::vector<ChunkMesh> &chunkMeshes() const;
+    // Still off their target after the last refine()
+    int pendingChunks() const;
+
+    // Hands the worker the chunks the focus points of path, the current one first, will
+    // need. Does nothing while the previous job is queued, runs or isn't collected
+    void prefetch(const std::vector<QVector3D> &path, bool optimizeIndices);
+    // Waits for the job and drops what was built ahead : to call before changing anything
+    // the chunks are built from, QuadNode parameters, vertex content or index optimization
+    void cancelPrefetch();
+
+    // Chunks the last refine() had to move to their target, and those of them that
+    // weren't built ahead
+    int neededChunks() const;
+    int notReadyChunks() const;
+    // Same since the start
+    qint64 totalNeededChunks() const;
+    qint64 totalNotReadyChunks() const;
+
+private:
+    // Depths the leaves aim for at the nearest and farthest points of a chunk
+    struct Detail
+    {
+        float nearDepth;
+        float farDepth;
+    };
+
+    // A chunk built ahead for focus, index -1 if none
+    struct Prefetched
+    {
+        int index;
+        QVector3D focus;
+        Detail detail;
+        ChunkMesh mesh;
+    };
+
+    // What buildAhead() works on, copies : refine() goes on meanwhile
+    struct PrefetchJob
+    {
+        int cells;
+        std::vector<Detail> built;
+        std::vector<Detail> ahead;
+        std::vector<QVector3D> path;
+        bool optimizeIndices;
+    };
+
+    static Detail targetDetail(int index, int cells, const QVector3D &focus);
+    static float detailError(const Detail &a, const Detail &b);
+    static std::vector<Prefetched> buildAhead(int cells, std::vector<Detail> built, std::vector<Detail> ahead,
+                                              std::vector<QVector3D> path, bool optimizeIndices);
+    // Worker loop : waits for a job, builds it, posts the results, until stopping
+    void work();
+    // Takes the results of a finished job without waiting for a running one
+    void collectPrefetched();
+    // Built ahead close enough to target
+    bool isPrefetched(int index, const Detail &target) const;
+
+    int cells;
+    std::vector<ChunkMesh> parts;
+    std::vector<Detail> built;
+    std::vector<std::pair<float, int>> queue;
+    int pending;
+    std::vector<Prefetched> ahead;
+    // The worker and its job slot, guarded by lock
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    PrefetchJob job;
+    bool queued;
+    bool running;
+    bool finished;
+    bool stopping;
+    std::vector<Prefetched> results;
+    int needed;
+    int notReady;
+    qint64 totalNeeded;
+    qint64 totalNotReady;
+};
+
+#endif // LODREFINER_H
@@ -51,45 +51,104 @@
 #include <QApplication>
 #include <QLabel>
 #include <QSurfaceFormat>
+#include <QCommandLineParser>
+#include <QScreen>
+
+#include <memory>
+#include <vector>
 
 #ifndef QT_NO_OPENGL
 #include "mainwidget.h"
+#include "seasonswidget.h"
+#include "framescheduler.h"
+#include "simulation.h"
 #include "quadnode.h"
+#include "heightpyramid.h"
+#include "assetloader.h"
+#include "terrainquery.h"
 #endif
 
 int main(int argc, char *argv[])
 {
-    QApplication app(argc, argv);
+    // The four windows draw the same terrain : let them share buffers and textures
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+    // Uniform blocks need GLSL 330, the compatibility profile keeps the HUD painter working.
+    // Set before QApplication so the global share context gets the same format
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CompatibilityProfile);
     QSurfaceFormat::setDefaultFormat(format);
+    QApplication app(argc, argv);
 
     app.setApplicationName("tp3");
     app.setApplicationVersion("0.1");
 
 #ifndef QT_NO_OPENGL
-    MainWidget widgetPrintemps(60, Season::Printemps);
-    MainWidget widgetEte(60, Season::Ete);
-    MainWidget widgetAutomne(60, Season::Automne);
-    MainWidget widgetHiver(60, Season::Hiver);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption singleWindow("single-window", "Draw the four seasons as viewports of one window.");
+    parser.addOption(singleWindow);
+    QCommandLineOption benchHeights("bench-heights", "Compare the row-major and tiled height layouts on a <size> x <size> grid, then quit.", "size");
+    parser.addOption(benchHeights);
+    QCommandLineOption benchPick("bench-pick", "Check terrain picking against a fine ray march on <rays> random rays, then quit.", "rays");
+    parser.addOption(benchPick);
+    parser.process(app);
 
+    if (parser.isSet(benchHeights))
+    {
+        HeightPyramid::benchmark(parser.value(benchHeights).toInt());
+        return 0;
+    }
+    if (parser.isSet(benchPick))
+    {
+        TerrainQuery::benchmark(parser.value(benchPick).toInt());
+        return 0;
+    }
 
-    widgetPrintemps.show();
-    widgetEte.show();
-    widgetAutomne.show();
-    widgetHiver.show();
+    // Images and the first quadtree are decoded while the windows open
+    AssetLoader::instance()->start();
 
+    // Pace every view to the display when swaps are synchronised with it
+    QScreen *screen = QGuiApplication::primaryScreen();
+    if (QSurfaceFormat::defaultFormat().swapInterval() > 0 && screen != nullptr)
+        FrameScheduler::instance()->setVsync(screen->refreshRate());
+
+    // The focus point is shared, it moves once per simulation step whatever the
+    // number of windows and their frame rate. The simulation keeps running even
+    // when every view is hidden; registered first so the views ticked in the
+    // same frame see the new state. The focus point waits for the first
+    // quadtree, built around it off the GUI thread, to be uploaded.
+    Simulation::instance()->add([]() {
+        if (GeometryEngine::hasTerrain())
+            autoMovePoint();
+    });
+    FrameScheduler::instance()->add(Simulation::rate, []() { Simulation::instance()->update(); });
 
     QTimer *seasonTimer = new QTimer;
+    std::vector<std::unique_ptr<MainWidget>> widgets;
 
-    QObject::connect(seasonTimer, SIGNAL(timeout()), &widgetPrintemps, SLOT(nextSeason()));
-    QObject::connect(seasonTimer, SIGNAL(timeout()), &widgetEte, SLOT(nextSeason()));
-    QObject::connect(seasonTimer, SIGNAL(timeout()), &widgetAutomne, SLOT(nextSeason()));
-    QObject::connect(seasonTimer, SIGNAL(timeout()), &widgetHiver, SLOT(nextSeason()));
+    if (parser.isSet(singleWindow))
+    {
+        widgets.emplace_back(new SeasonsWidget(60));
+    }
+    else
+    {
+        widgets.emplace_back(new MainWidget(60, Season::Printemps));
+        widgets.emplace_back(new MainWidget(60, Season::Ete));
+        widgets.emplace_back(new MainWidget(60, Season::Automne));
+        widgets.emplace_back(new MainWidget(60, Season::Hiver));
+    }
 
+    for (std::unique_ptr<MainWidget> &widget : widgets)
+    {
+        widget->show();
+        QObject::connect(seasonTimer, SIGNAL(timeout()), widget.get(), SLOT(nextSeason()));
+    }
 
     seasonTimer->start(5000);
 
+
 #else
     QLabel note("OpenGL Support required");
     note.show();
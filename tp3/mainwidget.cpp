@@ -50,48 +50,116 @@
 
 #include "mainwidget.h"
 #include "quadnode.h"
+#include "profiler.h"
+#include "simulation.h"
+#include "shaderlibrary.h"
+#include "assetloader.h"
+#include "terrainquery.h"
+#include "lodcontroller.h"
 
 #include <QMouseEvent>
+#include <QPainter>
+#include <QWindow>
 
+#include <iostream>
 #include <math.h>
 
 double MainWidget::speedChange = .0;
+bool MainWidget::groundClamp = false;
+bool MainWidget::occlusionCulling = true;
+int MainWidget::instances = 0;
+QOpenGLTexture *MainWidget::sharedTexture = nullptr;
+int MainWidget::textureUsers = 0;
+bool MainWidget::textured = true;
 Camera MainWidget::camera = Camera(.0f, .0f, 20.f);
 
-MainWidget::MainWidget(int fps, Season season, QWidget *parent) :
+MainWidget::MainWidget(double fps, Season season, QWidget *parent) :
     QOpenGLWidget(parent),
+    program(nullptr),
     geometries(nullptr),
     texture(nullptr),
+    stats(nullptr),
+    frameUniforms(nullptr),
+    viewUniforms(nullptr),
+    glState(this),
+    season(season),
+    frameId(-1),
+    dirty(DirtyAll),
+    cameraRevision(0),
+    lodRevision(0),
+    lodSample(-1),
+    showHud(false),
+    drawMode(DrawMode::Wire),
+    timing(fps),
+    placeholderMs(-1),
+    startupReported(false),
+    aiming(false),
     rotationAxis(0, 0, 1),
     angularSpeed(1),
     fps(fps),
-    season(season),
+    viewId(instances++),
     gravity(.05f)
 {
     resize(1280, 720);
     setMouseTracking(true);
+    LodController::instance()->addView(fps);
     updateSeason();
+    simulationId = Simulation::instance()->add([this]() {
+        stepRotation();
+        stepCamera();
+    });
+    connect(this, &QOpenGLWidget::frameSwapped, [this]() {
+        timing.frames.mark();
+        reportStartup();
+    });
 }
 
 MainWidget::~MainWidget()
 {
+    Simulation::instance()->remove(simulationId);
+    if (frameId >= 0)
+        FrameScheduler::instance()->remove(frameId);
+
     // Make sure the context is current when deleting the texture
     // and the buffers.
     makeCurrent();
-    delete texture;
-    delete geometries;
+    delete stats;
+    for (QOpenGLShaderProgram *shader : variants)
+        ShaderLibrary::release(shader);
+    delete viewUniforms;
+    if (frameUniforms != nullptr)
+        FrameUniformBuffer::release();
+    if (texture != nullptr && --textureUsers == 0)
+    {
+        delete sharedTexture;
+        sharedTexture = nullptr;
+    }
+    if (geometries != nullptr)
+    {
+        geometries->releaseVertexArray();
+        GeometryEngine::release();
+    }
     doneCurrent();
 }
 
 //! [0]
 void MainWidget::mousePressEvent(QMouseEvent *e)
 {
+    // Right click : the focus point goes to the ground under the pointer while aiming,
+    // otherwise where the view looks. The look pointer is always at the widget centre
+    if (e->button() == Qt::RightButton)
+    {
+        pickFocus(aiming ? e->pos() : viewportAt(e->pos()).center());
+        return;
+    }
     // Save mouse press position
     mousePressPosition = QVector2D(e->localPos());
 }
 
 void MainWidget::mouseReleaseEvent(QMouseEvent *e)
 {
+    if (e->button() == Qt::RightButton)
+        return;
     // Mouse release position - mouse press position
     QVector2D diff = QVector2D(e->localPos()) - mousePressPosition;
 
@@ -110,45 +178,108 @@ void MainWidget::mouseReleaseEvent(QMouseEvent *e)
 }
 //! [0]
 
+void MainWidget::pickFocus(const QPoint &pos)
+{
+    PROFILE_ZONE_VIEW("pickFocus", viewId);
+    // The focus point belongs to the loader until the terrain is there
+    if (geometries == nullptr)
+        return;
+    QRect viewport = viewportAt(pos);
+    float x = 2.f * (pos.x() - viewport.left()) / viewport.width() - 1.f;
+    float y = 1.f - 2.f * (pos.y() - viewport.top()) / viewport.height();
+    // Traced in terrain coordinates, where the heights are
+    Ray ray = camera.rayThrough(x, y, projection).mapped(modelMatrix().inverted());
+    RayHit hit = TerrainQuery::intersect(ray);
+    if (!hit.hit)
+        return;
+    // Off the path of autoMovePoint(), the point stays where it was put
+    QuadNode::p.setX(hit.position.x());
+    QuadNode::p.setY(hit.position.y());
+}
+
 void MainWidget::mouseMoveEvent(QMouseEvent *e)
 {
     QPoint center = mapToGlobal(QPoint(width() / 2.f, height() / 2.f));
-    camera.processMouseMovement(width() / 2.f - e->pos().x(), height() / 2.f - e->pos().y());
     QCursor c = cursor();
+    if (e->modifiers() & Qt::ShiftModifier)
+    {
+        // Leave the pointer where it is, it shows what a right click picks
+        aiming = true;
+        c.setShape(Qt::CrossCursor);
+        setCursor(c);
+        return;
+    }
+    // Back from aiming the pointer is off centre : only recentre it
+    if (!aiming)
+        camera.processMouseMovement(width() / 2.f - e->pos().x(), height() / 2.f - e->pos().y());
+    aiming = false;
     c.setPos(center);
     c.setShape(Qt::BlankCursor);
     setCursor(c);
 }
 
-//! [1]
-void MainWidget::timerEvent(QTimerEvent *)
+void MainWidget::tick()
 {
-    // Decrease angular speed (friction)
-    //angularSpeed *= 0.99;
+    PROFILE_ZONE_VIEW("tick", viewId);
+    timing.ticks.mark();
 
-    // Stop rotation when speed goes below threshold
-    //if (angularSpeed < 0.01) {
-    //    angularSpeed = 0.0;
-    //} else {
-        // Update rotation
-    angularSpeed = speedChange;
-    rotation = QQuaternion::fromAxisAndAngle(rotationAxis, static_cast<float>(angularSpeed)) * rotation;
+    // Catch up with the fixed timestep before looking at what changed
+    Simulation::instance()->update();
 
-        // Request an update
+    // Assets decoded meanwhile : finish on the GL side and replace the placeholder
+    if (geometries == nullptr && context() != nullptr && AssetLoader::instance()->isReady())
+    {
+        makeCurrent();
+        initResources();
+        doneCurrent();
+        markDirty(DirtyAll);
+    }
+
+    // Still interpolating between the last two simulated rotations
+    if (rotation != previousRotation)
+        markDirty(DirtyModel);
+
+    // The camera and the focus point are shared by every view
+    if (camera.getRevision() != cameraRevision)
+        markDirty(DirtyCamera);
+    // So is the detail of the terrain
+    if (LodController::instance()->revision() != lodRevision)
+        markDirty(DirtyModel);
+    if (QuadNode::p != focus)
+        markDirty(DirtyFocus);
+    // Chunks still refining towards the last focus point
+    if (geometries != nullptr && geometries->pendingChunks() > 0)
+        markDirty(DirtyFocus);
+
+    // Request an update only if something changed and somebody can see it
+    if (dirty != DirtyNone && isExposed())
         update();
-    //}
 }
-//! [1]
 
 void MainWidget::initializeGL()
 {
     initializeOpenGLFunctions();
 
     glClearColor(0, 0, 0, 1);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    initShaders();
+    stats = new FrameStats(this);
+    frameUniforms = FrameUniformBuffer::acquire();
+    viewUniforms = new ViewUniformBuffer(this, viewCount());
+    // Nothing here waits for the assets : the links run on the driver's threads while the
+    // loader decodes, both variants of the texture are prepared
+    prepareVariants();
+    // Everything above bound behind the cache's back
+    glState.invalidate();
+
+    // Draws the placeholder until tick() finds the assets decoded
+    startFrameTimer();
+}
+
+void MainWidget::initResources()
+{
+    PROFILE_ZONE_VIEW("initResources", viewId);
     initTextures();
+    initShaders();
 
 //! [2]
     // Enable depth buffer
@@ -158,39 +289,180 @@ void MainWidget::initializeGL()
     glEnable(GL_CULL_FACE);
 //! [2]
 
-    geometries = new GeometryEngine;
+    // Every widget shares the same context group (Qt::AA_ShareOpenGLContexts),
+    // the terrain buffers and the texture are only created once
+    geometries = GeometryEngine::acquire();
+    // Only the first widget gets the mesh built by the loader, the others share the engine
+    geometries->setPrebuiltMesh(AssetLoader::instance()->takeInitialMesh());
+    // Everything above bound behind the cache's back
+    glState.invalidate();
+}
+
+//! [1]
+void MainWidget::stepRotation()
+{
+    // Decrease angular speed (friction)
+    //angularSpeed *= 0.99;
+
+    // Stop rotation when speed goes below threshold
+    //if (angularSpeed < 0.01) {
+    //    angularSpeed = 0.0;
+    //} else {
+        // Update rotation, angularSpeed is in degrees per simulation step
+    angularSpeed = speedChange;
+    previousRotation = rotation;
+    if (!qFuzzyIsNull(angularSpeed))
+    {
+        rotation = QQuaternion::fromAxisAndAngle(rotationAxis, static_cast<float>(angularSpeed)) * rotation;
+        markDirty(DirtyModel);
+    }
+    //}
+}
+//! [1]
+
+void MainWidget::stepCamera()
+{
+    // The camera is shared by every view : the first one moves it, above its own terrain
+    if (!groundClamp || viewId != 0 || geometries == nullptr)
+        return;
+    // The simulated rotation itself : the step doesn't depend on where the last frame was drawn.
+    // Gravity pulls along the axis the clamp lifts along, or the camera would slide sideways
+    QMatrix4x4 terrain = modelMatrix(rotation);
+    camera.ApplyGravity(gravity, terrain);
+    camera.clampToGround(terrain, eyeHeight);
+}
 
-    // Use QBasicTimer because its faster than QTimer
-    timer.start((1000 / fps), this);
+void MainWidget::startFrameTimer()
+{
+    // One scheduler drives every view, at the exact (possibly fractional) rate
+    if (frameId < 0)
+        frameId = FrameScheduler::instance()->add(fps, [this]() { tick(); });
+    else
+        FrameScheduler::instance()->setPaused(frameId, false);
 }
 
-//! [3]
-void MainWidget::initShaders()
+int MainWidget::viewCount() const
 {
-    // Compile vertex shader
-    if (!program.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/vshader.glsl"))
-        close();
+    return 1;
+}
 
-    // Compile fragment shader
-    if (!program.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/fshader.glsl"))
-        close();
+int MainWidget::renderFeatures() const
+{
+    int features = ShaderPrecombinedMvp;
+    if (textured)
+        features |= ShaderTextured;
+    if (geometries != nullptr)
+        features |= geometries->vertexFeatures();
+    if (drawMode == DrawMode::Wire)
+        features |= ShaderWireframe;
+    else if (drawMode == DrawMode::SolidWire)
+        features |= ShaderWireframe | ShaderWireFill;
+    return features;
+}
 
-    // Link shader pipeline
-    if (!program.link())
-        close();
+QOpenGLShaderProgram *MainWidget::variant(int features)
+{
+    if (variants.contains(features))
+        return variants.value(features);
+
+    QString geometryShader = (features & ShaderWireframe) ? ":/gshader.glsl" : "";
+    // Texturing and wireframe only change the look of a frame or two, vertices must match
+    const int vertexMask = ShaderGpuDisplacement | ShaderPackedVertices;
+    if (program != nullptr && (variants.key(program) & vertexMask) == (features & vertexMask)
+            && !ShaderLibrary::isLinked(this, ":/vshader.glsl", geometryShader, ":/fshader.glsl", features))
+    {
+        // Polled again next frame
+        markDirty(DirtyModel);
+        return program;
+    }
+    QOpenGLShaderProgram *shader = ShaderLibrary::acquire(this, ":/vshader.glsl", geometryShader, ":/fshader.glsl", features);
+    if (shader != nullptr)
+        variants.insert(features, shader);
+    // Binds behind the cache's back
+    glState.invalidate();
+    return shader;
+}
+
+void MainWidget::markDirty(int flags)
+{
+    dirty |= flags;
+}
 
-    // Bind shader pipeline for use
-    if (!program.bind())
+bool MainWidget::isExposed() const
+{
+    QWindow *handle = window()->windowHandle();
+    return isVisible() && !window()->isMinimized() && (handle == nullptr || handle->isExposed());
+}
+
+void MainWidget::showEvent(QShowEvent *e)
+{
+    QOpenGLWidget::showEvent(e);
+    markDirty(DirtyAll);
+    if (context() != nullptr)
+        startFrameTimer();
+}
+
+void MainWidget::hideEvent(QHideEvent *e)
+{
+    // Nothing to draw until the window comes back
+    if (frameId >= 0)
+        FrameScheduler::instance()->setPaused(frameId, true);
+    QOpenGLWidget::hideEvent(e);
+}
+
+void MainWidget::changeEvent(QEvent *e)
+{
+    if (e->type() == QEvent::WindowStateChange)
+    {
+        if (window()->isMinimized() && frameId >= 0)
+            FrameScheduler::instance()->setPaused(frameId, true);
+        else if (!window()->isMinimized() && context() != nullptr)
+        {
+            markDirty(DirtyAll);
+            startFrameTimer();
+        }
+    }
+    QOpenGLWidget::changeEvent(e);
+}
+
+//! [3]
+void MainWidget::initShaders()
+{
+    // Started by initializeGL(), waits only if the driver hasn't finished this one yet
+    program = variant(renderFeatures());
+    if (program == nullptr)
         close();
 }
+
+void MainWidget::prepareVariants()
+{
+    for (int features = 0; features < ShaderWireFill * 2; features++)
+    {
+        // Textured or not, both vertex features, solid, wire and solid + wire : the
+        // matrices are always precombined, faces only filled under a wireframe
+        if (!(features & ShaderPrecombinedMvp) || ((features & ShaderWireFill) && !(features & ShaderWireframe)))
+            continue;
+        QString geometryShader = (features & ShaderWireframe) ? ":/gshader.glsl" : "";
+        ShaderLibrary::prepare(this, ":/vshader.glsl", geometryShader, ":/fshader.glsl", features);
+    }
+}
 //! [3]
 
 //! [4]
 void MainWidget::initTextures()
 {
-    // Load cube.png image
-    //texture = new QOpenGLTexture(QImage(":/heightmap-1.png"));//.mirrored());
-    texture = new QOpenGLTexture(QImage(":/blanc.png"));//.mirrored());
+    if (sharedTexture != nullptr)
+    {
+        texture = sharedTexture;
+        textureUsers++;
+        return;
+    }
+
+    // Decoded by the AssetLoader
+    texture = new QOpenGLTexture(AssetLoader::instance()->textureImage());//.mirrored());
+
+    // A plain white texture leaves the colour unchanged : the untextured variants skip the fetch
+    textured = AssetLoader::instance()->isTextured();
 
     // Set nearest filtering mode for texture minification
     texture->setMinificationFilter(QOpenGLTexture::Nearest);
@@ -201,6 +473,9 @@ void MainWidget::initTextures()
     // Wrap texture coordinates by repeating
     // f.ex. texture coordinate (1.1, 1.2) is same as (0.1, 0.2)
     texture->setWrapMode(QOpenGLTexture::Repeat);
+
+    sharedTexture = texture;
+    textureUsers++;
 }
 //! [4]
 
@@ -218,17 +493,78 @@ void MainWidget::resizeGL(int w, int h)
 
     // Set perspective projection
     projection.perspective(fov, static_cast<float>(aspect), zNear, zFar);
+
+    // Qt recreated the widget's framebuffer and its texture
+    glState.invalidate();
+    markDirty(DirtySize);
 }
 //! [5]
 
 void MainWidget::paintGL()
 {
+    PROFILE_ZONE_VIEW("paintGL", viewId);
+    if (geometries == nullptr)
+    {
+        drawPlaceholder();
+        return;
+    }
+    beginFrame();
+
+    float buildMs = buildTerrain();
+
+    stats->beginStage(GpuStage::Terrain);
+    drawTerrain(groundColor);
+    stats->endStage();
+
+    endFrame(buildMs);
+}
+
+void MainWidget::beginFrame()
+{
+    // Qt may repaint on its own (expose, resize) : whatever was pending is drawn now
+    dirty = DirtyNone;
+    cameraRevision = camera.getRevision();
+    lodRevision = LodController::instance()->revision();
+    focus = QuadNode::p;
+
+    stats->beginFrame();
+    glState.resetCounters();
+
+    // The HUD painter leaves its own state behind, restore ours
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    program = variant(renderFeatures());
+    glState.useProgram(program != nullptr ? program->programId() : 0);
+
     // Clear color and depth buffer
+    stats->beginStage(GpuStage::Clear);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    stats->endStage();
+
+    if (textured)
+        glState.bindTexture(0, texture->textureId());
+    if (GeometryEngine::gpuDisplacement)
+        glState.bindTexture(1, geometries->heightTextureId());
 
-    texture->bind();
+    // Binding points belong to the context, the buffer to the share group
+    frameUniforms->update(camera, glState);
+    frameUniforms->bind(glState);
+}
 
 //! [6]
+QRect MainWidget::viewportAt(const QPoint &) const
+{
+    return rect();
+}
+
+QMatrix4x4 MainWidget::modelMatrix() const
+{
+    // Render between the last two simulated states
+    return modelMatrix(QQuaternion::slerp(previousRotation, rotation, Simulation::instance()->alpha()));
+}
+
+QMatrix4x4 MainWidget::modelMatrix(const QQuaternion &orientation) const
+{
     // Calculate model view transformation
     QMatrix4x4 matrix;
 
@@ -244,34 +580,117 @@ void MainWidget::paintGL()
     // QVector3D up = QVector3D(-1,0,0);
     // matrix.lookAt(eye,center,up);
 
-    //camera.ApplyGravity(gravity);
-    //if (camera.getY() < .0f) camera.setY(.0f);
+    matrix.rotate(orientation);
+    return matrix;
+}
 
-    matrix.rotate(rotation);
+float MainWidget::buildTerrain()
+{
+    QElapsedTimer buildTimer;
+    buildTimer.start();
+    stats->beginStage(GpuStage::LodBuild);
+    geometries->update(glState);
+    stats->endStage();
+    return buildTimer.nsecsElapsed() / 1e6f;
+}
 
-    program.setUniformValue("a_color", groundColor);
-    autoMovePoint();
+void MainWidget::drawTerrain(const QVector4D &color, int slot)
+{
+    // Model, projection and colour of this view, re-uploaded only when they change
+    QMatrix4x4 model = modelMatrix();
+    QMatrix4x4 view = camera.getViewMatrix();
+    viewUniforms->set(glState, slot, model, view, projection, color);
 
-    // Set modelview-projection matrix
-    program.setUniformValue("m_matrix", matrix);
-    program.setUniformValue("v_matrix", camera.getViewMatrix());
-    program.setUniformValue("p_matrix", projection);
+    // Draw cube geometry
+    //geometries->drawPlaneGeometry(glState);
+    if (!occlusionCulling || geometries->chunks().empty())
+    {
+        geometries->drawQuadTree(glState);
+        return;
+    }
+    QVector3D eye = (view * model).inverted().map(QVector3D(0.f, 0.f, 0.f));
+    culler.cull(geometries->chunks(), projection * view * model, eye, visibleChunks);
+    stats->addCulled(culler.culledChunks(), culler.culledTriangles());
+    geometries->drawChunks(glState, visibleChunks);
+}
 
+void MainWidget::endFrame(float buildMs)
+{
+    // Timings known since the last frame, then the detail of the next build
+    LodController *lod = LodController::instance();
+    const FrameSample &measured = stats->last();
+    if (measured.frame != lodSample)
+    {
+        lodSample = measured.frame;
+        if (measured.frame >= 0)
+            lod->addFrame(measured.cpuBuildMs, measured.gpuTotalMs);
+    }
+    geometries->setDetail(lod->startDepth(), lod->maxDist());
+    stats->setLod(lod->level(), lod->startDepth(), lod->maxDist(), lod->costMs(), lod->targetMs());
+    stats->setPrefetch(geometries->neededChunks(), geometries->notReadyChunks());
+    // Two triangles per leaf
+    stats->endFrame(buildMs, geometries->triangleCount(), geometries->triangleCount() / 2, geometries->uploadedBytes());
+
+    if (showHud)
+        drawHud();
+}
 
+void MainWidget::drawPlaceholder()
+{
+    // Shown from the first frame while the assets are decoded
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    QPainter painter(this);
+    painter.setPen(Qt::white);
+    painter.drawText(rect(), Qt::AlignCenter, "Loading terrain...");
+    painter.end();
 
-    // Use texture unit 0 which contains cube.png
-    program.setUniformValue("texture", 0);
+    glState.invalidate();
+}
 
-    // Draw cube geometry
-    makeCurrent();
-    //geometries->drawPlaneGeometry(&program);
-    geometries->initQuadTree();
-    geometries->drawQuadTree(&program);
-    doneCurrent();
+void MainWidget::reportStartup()
+{
+    // Time to first frame, counted from AssetLoader::start() at process start
+    if (startupReported)
+        return;
+    qint64 elapsed = AssetLoader::instance()->elapsedMs();
+    if (geometries == nullptr)
+    {
+        if (placeholderMs < 0)
+            placeholderMs = elapsed;
+        return;
+    }
+    std::cerr << windowTitle().toStdString() << " : first frame after " << (placeholderMs < 0 ? elapsed : placeholderMs)
+              << " ms, terrain after " << elapsed << " ms" << std::endl;
+    startupReported = true;
+}
 
+void MainWidget::drawHud()
+{
+    QPainter painter(this);
+    stats->drawOverlay(painter, QRect(10, 10, 360, 210));
+
+    // Presented frames only follow the requested rate while something moves
+    painter.fillRect(QRect(10, 220, 520, 78), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(16, 234, timing.ticks.summary());
+    painter.drawText(16, 248, timing.frames.summary());
+    painter.drawText(16, 262, QString("binds %1  elided %2  variant %3").arg(glState.issued()).arg(glState.elided()).arg(renderFeatures()));
+    painter.drawText(16, 276, QString("acmr %1 -> %2  (%3 vertices)  pending %4 chunks").arg(geometries->generatedAcmr(), 0, 'f', 3).arg(geometries->drawnAcmr(), 0, 'f', 3).arg(geometries->vertexCount()).arg(geometries->pendingChunks()));
+    // Share of the chunks the refiner needed that the prefetch hadn't built ahead
+    qint64 needed = geometries->totalNeededChunks();
+    qint64 notReady = geometries->totalNotReadyChunks();
+    painter.drawText(16, 290, QString("prefetch : %1 of %2 needed chunks not ready (%3 %)").arg(notReady).arg(needed)
+                     .arg(needed > 0 ? 100.0 * notReady / needed : 0.0, 0, 'f', 1));
+    painter.end();
+
+    glState.invalidate();
 }
 
 void MainWidget::keyPressEvent(QKeyEvent *e) {
+    PROFILE_ZONE_VIEW("keyPressEvent", viewId);
+    // The focus point and the engine belong to the loader until the terrain is there
+    if (geometries == nullptr && e->key() != Qt::Key_Escape)
+        return;
     switch (e->key()) {
     case Qt::Key_Plus:
         speedChange += 0.1;
@@ -305,13 +724,62 @@ void MainWidget::keyPressEvent(QKeyEvent *e) {
         break;
     case Qt::Key_A:
         posZ -= 1.f/10.f;
+        markDirty(DirtyModel);
         break;
     case Qt::Key_E:
         posZ += 1.f/10.f;
+        markDirty(DirtyModel);
         break;
     case Qt::Key_Space:
         camera.processMovement(Direction::UP, 3.f);
         break;
+    case Qt::Key_G:
+        groundClamp = !groundClamp;
+        break;
+    case Qt::Key_F1:
+        showHud = !showHud;
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F3:
+        timing.save("tp3-timing-" + std::to_string(viewId));
+        break;
+    case Qt::Key_F4:
+        // Heights fetched by the vertex shader instead of the quadtree build
+        geometries->setVertexFeatures(geometries->vertexFeatures() ^ ShaderGpuDisplacement);
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F5:
+        geometries->setVertexFeatures(geometries->vertexFeatures() ^ ShaderPackedVertices);
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F6:
+        // Wire, solid + wire, solid
+        drawMode = static_cast<DrawMode>((static_cast<int>(drawMode) + 1) % 3);
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F7:
+        geometries->setIndexOptimization(!geometries->indexOptimization());
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F8:
+        occlusionCulling = !occlusionCulling;
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F9:
+        // Detail adapted to the frame time, back to the configured one when off
+        LodController::instance()->setEnabled(!LodController::instance()->isEnabled());
+        markDirty(DirtyModel);
+        break;
+    case Qt::Key_F10:
+        // Chunks rebuilt within the budget of each frame, or the whole tree at once
+        geometries->setRefineBudget(geometries->refineBudget() > 0 ? 0 : GeometryEngine::defaultRefineBudget);
+        markDirty(DirtyModel);
+        break;
+#ifdef TP3_PROFILE
+    case Qt::Key_F2:
+        Profiler::dump("tp3-trace.json");
+        break;
+#endif
     case Qt::Key_Escape:
         std::exit(EXIT_SUCCESS);
     default:
@@ -320,45 +788,49 @@ void MainWidget::keyPressEvent(QKeyEvent *e) {
 }
 
 void MainWidget::nextSeason() {
+    season = seasonAfter(season, 1);
+    updateSeason();
+}
+
+void MainWidget::updateSeason() {
+    setWindowTitle(seasonName(season));
+    groundColor = seasonColor(season);
+    markDirty(DirtySeason);
+}
+
+Season MainWidget::seasonAfter(Season season, int steps)
+{
+    return static_cast<Season>((static_cast<int>(season) + steps) % 4);
+}
+
+QString MainWidget::seasonName(Season season)
+{
     switch (season)
     {
         case Season::Printemps:
-            season = Season::Ete;
-            break;
+            return "Printemps";
         case Season::Ete:
-            season = Season::Automne;
-            break;
+            return "Été";
         case Season::Automne:
-            season = Season::Hiver;
-        break;
+            return "Automne";
         case Season::Hiver:
-            season = Season::Printemps;
-        break;
-    };
-    updateSeason();
-
+            break;
+    }
+    return "Hiver";
 }
 
-void MainWidget::updateSeason() {
+QVector4D MainWidget::seasonColor(Season season)
+{
     switch (season)
     {
         case Season::Printemps:
-            setWindowTitle("Printemps");
-            groundColor = QVector4D(0.9f,1.f,0.5f,1.f);
-            break;
-
+            return QVector4D(0.9f,1.f,0.5f,1.f);
         case Season::Ete:
-            setWindowTitle("Été");
-            groundColor = QVector4D(0.9f,0.8f,0.1f,1.f);
-            break;
-
+            return QVector4D(0.9f,0.8f,0.1f,1.f);
         case Season::Automne:
-            setWindowTitle("Automne");
-            groundColor = QVector4D(1.f,0.5f,0.1f,1.f);
-            break;
-
+            return QVector4D(1.f,0.5f,0.1f,1.f);
         case Season::Hiver:
-            setWindowTitle("Hiver");
-            groundColor = QVector4D(1.f,1.f,1.f,1.f);
+            break;
     }
+    return QVector4D(1.f,1.f,1.f,1.f);
 }
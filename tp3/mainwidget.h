@@ -53,6 +53,12 @@
 
 #include "geometryengine.h"
 #include "camera.h"
+#include "framestats.h"
+#include "framescheduler.h"
+#include "frametiming.h"
+#include "uniformbuffers.h"
+#include "glstatecache.h"
+#include "horizonculler.h"
 
 #include <QOpenGLWidget>
 //#include <QOpenGLFunctions>
@@ -60,15 +66,30 @@
 #include <QMatrix4x4>
 #include <QQuaternion>
 #include <QVector2D>
-#include <QBasicTimer>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
+#include <QHash>
 
 class GeometryEngine;
 
 enum class Season { Printemps = 0, Ete = 1, Automne = 2, Hiver = 3 };
 
+// Wireframe is drawn by the fill pass (barycentric edges), not with glPolygonMode(GL_LINE)
+enum class DrawMode { Wire = 0, SolidWire = 1, Solid = 2 };
+
+// What changed since the last painted frame
+enum Dirty {
+    DirtyNone = 0,
+    DirtyCamera = 1,
+    DirtyFocus = 2,
+    DirtySeason = 4,
+    DirtySize = 8,
+    DirtyModel = 16,
+    DirtyAll = 31
+};
+
 class MainWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_5_Core
 
 
@@ -76,7 +97,7 @@ class MainWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_5_Core
     Q_OBJECT
 
 public:
-    explicit MainWidget(int fps, Season season, QWidget *parent = nullptr);
+    explicit MainWidget(double fps, Season season, QWidget *parent = nullptr);
     ~MainWidget() override;
     Camera static camera;
 
@@ -85,36 +106,111 @@ protected:
     void mousePressEvent(QMouseEvent *e) override;
     void mouseReleaseEvent(QMouseEvent *e) override;
     void mouseMoveEvent(QMouseEvent *e) override;
-    void timerEvent(QTimerEvent *e) override;
 
     void initializeGL() override;
     void resizeGL(int w, int h) override;
     void paintGL() override;
     void keyPressEvent(QKeyEvent *e) override;
+    // Called by the FrameScheduler at the requested rate
+    virtual void tick();
+    void showEvent(QShowEvent *e) override;
+    void hideEvent(QHideEvent *e) override;
+    void changeEvent(QEvent *e) override;
 
     void initShaders();
+    // Starts linking every variant renderFeatures() can ask for, see ShaderLibrary::prepare()
+    void prepareVariants();
     void initTextures();
-
-private:
-    void updateSeason();
-    QBasicTimer timer;
-    QOpenGLShaderProgram program;
+    // Everything built from the decoded assets, once AssetLoader is ready
+    void initResources();
+    void drawPlaceholder();
+
+    // Frame stages shared by the single and multi-viewport renderers
+    void beginFrame();
+    // Terrain placed for the frame, interpolated between the last two simulated rotations
+    QMatrix4x4 modelMatrix() const;
+    // Terrain placed with the given rotation
+    QMatrix4x4 modelMatrix(const QQuaternion &orientation) const;
+    // Viewport under a point of the widget, in widget coordinates
+    virtual QRect viewportAt(const QPoint &pos) const;
+    float buildTerrain();
+    void drawTerrain(const QVector4D &color, int slot = 0);
+    void endFrame(float buildMs);
+    virtual void updateSeason();
+    // Per-view uniform slots, one per viewport drawn in a frame
+    virtual int viewCount() const;
+    // ShaderFeature flags of the program the current state needs
+    int renderFeatures() const;
+    // Program specialised for features. While it still links, the current program if it
+    // reads the same vertices : switching never waits for the driver
+    QOpenGLShaderProgram *variant(int features);
+
+    void markDirty(int flags);
+    bool isExposed() const;
+
+    static Season seasonAfter(Season season, int steps);
+    static QString seasonName(Season season);
+    static QVector4D seasonColor(Season season);
+
+    QOpenGLShaderProgram *program;
     GeometryEngine *geometries;
-
     QOpenGLTexture *texture;
-
+    FrameStats *stats;
+    FrameUniformBuffer *frameUniforms;
+    ViewUniformBuffer *viewUniforms;
+    GLStateCache glState;
     QMatrix4x4 projection;
+    Season season;
+
+private:
+    void drawHud();
+    void reportStartup();
+    void startFrameTimer();
+    void stepRotation();
+    void stepCamera();
+    // Moves the focus point where the terrain is under pos
+    void pickFocus(const QPoint &pos);
+    int frameId;
+    int simulationId;
+    int dirty;
+    unsigned int cameraRevision;
+    unsigned int lodRevision;
+    // Last FrameStats sample given to the LodController
+    int lodSample;
+    QVector3D focus;
+
+    static QOpenGLTexture *sharedTexture;
+    static int textureUsers;
+    static bool textured;
+    QHash<int, QOpenGLShaderProgram *> variants;
+    bool showHud;
+    DrawMode drawMode;
+    FrameTiming timing;
+    qint64 placeholderMs;
+    bool startupReported;
 
     QVector2D mousePressPosition;
+    // Shift held : the pointer is free to aim instead of turning the camera
+    bool aiming;
     QVector3D rotationAxis;
     qreal angularSpeed;
     QQuaternion rotation;
+    QQuaternion previousRotation;
     float posX = 0.f, posY = 0.f, posZ = -10.f;
-    int fps;
-    Season season;
+    double fps;
+    int viewId;
+    static int instances;
     QVector4D groundColor = QVector4D(1.0, 1.0, 1.0, 1.0);
     static double speedChange;
     float gravity;
+    // Above the ground, in terrain units
+    float eyeHeight = .5f;
+    // G : the camera falls and walks on the terrain
+    static bool groundClamp;
+    // F8 : chunks hidden behind the horizon are not drawn
+    static bool occlusionCulling;
+    HorizonCuller culler;
+    std::vector<int> visibleChunks;
     int i = 0;
     public slots:
         void nextSeason();
@@ -0,0 +1,160 @@
+#include "minmaxpyramid.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <thread>
+
+namespace
+{
+    // Below this many rows a level isn't worth a thread
+    const int rowsPerTask = 32;
+
+    HeightRange merge(HeightRange a, const HeightRange &b)
+    {
+        a.min = std::min(a.min, b.min);
+        a.max = std::max(a.max, b.max);
+        return a;
+    }
+
+    // Calls fill(first, last) on bands of [0, height) : on the pool threads, the last one on ours
+    void inBands(int height, const std::function<void(int, int)> &fill)
+    {
+        int tasks = std::min(static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)),
+                             std::max(height / rowsPerTask, 1));
+        int rows = (height + tasks - 1) / tasks;
+        std::vector<std::future<void>> bands;
+        for (int first = 0; first < height; first += rows)
+        {
+            int last = std::min(first + rows, height);
+            if (last == height)
+                fill(first, last);
+            else
+                bands.push_back(std::async(std::launch::async, std::cref(fill), first, last));
+        }
+        for (std::future<void> &band : bands)
+            band.wait();
+    }
+}
+
+void MinMaxPyramid::build(const HeightField<float> &heights)
+{
+    PROFILE_ZONE("MinMaxPyramid::build");
+    levels.clear();
+    cellsX = cellsY = 0;
+    if (heights.width() < 2 || heights.height() < 2)
+        return;
+    cellsX = heights.width() - 1;
+    cellsY = heights.height() - 1;
+
+    Level tiles;
+    tiles.width = (cellsX + tileCells - 1) / tileCells;
+    tiles.height = (cellsY + tileCells - 1) / tileCells;
+    tiles.ranges = SampleStore<HeightRange>(static_cast<size_t>(tiles.width) * tiles.height);
+    inBands(tiles.height, [&](int firstRow, int lastRow)
+    {
+        for (int ty = firstRow; ty < lastRow; ty++)
+            for (int tx = 0; tx < tiles.width; tx++)
+            {
+                // Samples of the tile's cells, corners included : the last tiles may be narrower
+                const int x0 = tx * tileCells, x1 = std::min(x0 + tileCells, cellsX);
+                const int y0 = ty * tileCells, y1 = std::min(y0 + tileCells, cellsY);
+                HeightRange range = { heights.at(x0, y0), heights.at(x0, y0) };
+                for (int y = y0; y <= y1; y++)
+                    for (int x = x0; x <= x1; x++)
+                    {
+                        float h = heights.at(x, y);
+                        range.min = std::min(range.min, h);
+                        range.max = std::max(range.max, h);
+                    }
+                tiles.ranges[static_cast<size_t>(ty) * tiles.width + tx] = range;
+            }
+    });
+    levels.push_back(std::move(tiles));
+
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        Level next;
+        next.width = (levels.back().width + 1) / 2;
+        next.height = (levels.back().height + 1) / 2;
+        next.ranges = SampleStore<HeightRange>(static_cast<size_t>(next.width) * next.height);
+        const Level &source = levels.back();
+        inBands(next.height, [&](int firstRow, int lastRow) { mergeRows(source, next, firstRow, lastRow); });
+        levels.push_back(std::move(next));
+    }
+}
+
+void MinMaxPyramid::mergeRows(const Level &source, Level &next, int firstRow, int lastRow)
+{
+    for (int y = firstRow; y < lastRow; y++)
+        for (int x = 0; x < next.width; x++)
+        {
+            // Odd sizes : the last range of a row or column has no neighbour to merge
+            int x1 = std::min(2 * x + 1, source.width - 1);
+            int y1 = std::min(2 * y + 1, source.height - 1);
+            next.ranges[static_cast<size_t>(y) * next.width + x] =
+                    merge(merge(source.at(2 * x, 2 * y), source.at(x1, 2 * y)), merge(source.at(2 * x, y1), source.at(x1, y1)));
+        }
+}
+
+void MinMaxPyramid::setLevels(std::vector<Level> built, int wide, int high)
+{
+    levels = std::move(built);
+    cellsX = wide;
+    cellsY = high;
+}
+
+bool MinMaxPyramid::isNull() const
+{
+    return levels.empty();
+}
+
+int MinMaxPyramid::cellsWide() const
+{
+    return cellsX;
+}
+
+int MinMaxPyramid::cellsHigh() const
+{
+    return cellsY;
+}
+
+int MinMaxPyramid::levelCount() const
+{
+    return static_cast<int>(levels.size());
+}
+
+const MinMaxPyramid::Level &MinMaxPyramid::level(int index) const
+{
+    return levels[static_cast<size_t>(index)];
+}
+
+HeightRange MinMaxPyramid::range(float u0, float v0, float u1, float v1) const
+{
+    // Cells touched by the area, a border on a grid line takes both sides
+    float fx0 = qBound(0.f, std::min(u0, u1), 1.f) * cellsX;
+    float fx1 = qBound(0.f, std::max(u0, u1), 1.f) * cellsX;
+    float fy0 = qBound(0.f, std::min(v0, v1), 1.f) * cellsY;
+    float fy1 = qBound(0.f, std::max(v0, v1), 1.f) * cellsY;
+    // Then the tiles holding them
+    int x0 = std::max(static_cast<int>(std::ceil(fx0)) - 1, 0) / tileCells;
+    int y0 = std::max(static_cast<int>(std::ceil(fy0)) - 1, 0) / tileCells;
+    int x1 = std::min(static_cast<int>(fx1), cellsX - 1) / tileCells;
+    int y1 = std::min(static_cast<int>(fy1), cellsY - 1) / tileCells;
+
+    // Climb until the tiles fit in 2 x 2 ranges of the level
+    size_t l = 0;
+    while (l + 1 < levels.size() && (x1 - x0 > 1 || y1 - y0 > 1))
+    {
+        x0 >>= 1; y0 >>= 1; x1 >>= 1; y1 >>= 1;
+        l++;
+    }
+    const Level &level = levels[l];
+    HeightRange bounds = level.at(x0, y0);
+    for (int y = y0; y <= y1; y++)
+        for (int x = x0; x <= x1; x++)
+            bounds = merge(bounds, level.at(x, y));
+    return bounds;
+}
@@ -0,0 +1,58 @@
+#ifndef MINMAXPYRAMID_H
+#define MINMAXPYRAMID_H
+
+#include "heightfield.h"
+
+#include <vector>
+
+// Lowest and highest height over an area
+struct HeightRange
+{
+    float min;
+    float max;
+};
+
+// Conservative height bounds of the terrain cells. Level 0 holds one range per tile of
+// tileCells x tileCells cells, each next level merges 2 x 2 ranges of the previous one up to
+// a single root. Lets a ray or a bounding volume skip whole quadtree nodes without reading
+// their samples; within a tile the samples themselves are read
+class MinMaxPyramid
+{
+public:
+    // One range per cell would weigh twice the float heightmap, 2 GiB at 16K
+    static const int tileCells = 4;
+
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        SampleStore<HeightRange> ranges;     // row-major
+
+        const HeightRange &at(int x, int y) const { return ranges[static_cast<size_t>(y) * width + x]; }
+    };
+
+    // Ranges in the units of the field
+    void build(const HeightField<float> &heights);
+    // Levels already built, from a baked terrain of wide x high cells
+    void setLevels(std::vector<Level> built, int wide, int high);
+    bool isNull() const;
+    // Cells of the field the ranges cover, one less than its samples
+    int cellsWide() const;
+    int cellsHigh() const;
+    int levelCount() const;
+    const Level &level(int index) const;
+
+    // Bounds of the area between u0, v0 and u1, v1 in [0, 1] from the north-west corner,
+    // read from the finest level where it covers at most 2 x 2 ranges
+    HeightRange range(float u0, float v0, float u1, float v1) const;
+
+private:
+    // Merges 2 x 2 ranges of source into next, for rows [firstRow, lastRow) of next
+    static void mergeRows(const Level &source, Level &next, int firstRow, int lastRow);
+
+    std::vector<Level> levels;
+    int cellsX = 0;
+    int cellsY = 0;
+};
+
+#endif // MINMAXPYRAMID_H
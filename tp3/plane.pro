@@ -5,9 +5,32 @@ TEMPLATE = app
 CONFIG += c++17
 QMAKE_CXXFLAGS += -std=c++17
 
+# qmake CONFIG+=profile records the PROFILE_ZONE timings, F2 dumps them as a Chrome trace
+profile {
+    DEFINES += TP3_PROFILE
+}
+
 SOURCES += main.cpp \
     quadnode.cpp \
-    camera.cpp
+    camera.cpp \
+    framestats.cpp \
+    profiler.cpp \
+    seasonswidget.cpp \
+    framescheduler.cpp \
+    simulation.cpp \
+    frametiming.cpp \
+    uniformbuffers.cpp \
+    glstatecache.cpp \
+    shaderlibrary.cpp \
+    indexoptimizer.cpp \
+    heightpyramid.cpp \
+    assetloader.cpp \
+    minmaxpyramid.cpp \
+    terraincache.cpp \
+    terrainquery.cpp \
+    horizonculler.cpp \
+    lodcontroller.cpp \
+    lodrefiner.cpp
 
 SOURCES += \
     mainwidget.cpp \
@@ -17,7 +40,27 @@ HEADERS += \
     mainwidget.h \
     geometryengine.h \
     quadnode.h \
-    camera.h
+    camera.h \
+    framestats.h \
+    profiler.h \
+    seasonswidget.h \
+    framescheduler.h \
+    simulation.h \
+    frametiming.h \
+    uniformbuffers.h \
+    glstatecache.h \
+    shaderlibrary.h \
+    indexoptimizer.h \
+    heightpyramid.h \
+    heightlayout.h \
+    heightfield.h \
+    assetloader.h \
+    minmaxpyramid.h \
+    terraincache.h \
+    terrainquery.h \
+    horizonculler.h \
+    lodcontroller.h \
+    lodrefiner.h
 
 RESOURCES += \
     shaders.qrc \
@@ -0,0 +1,77 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    // Buffers are registered once per thread and live until exit
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ProfileBuffer>> registry;
+}
+
+int64_t Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileBuffer &Profiler::threadBuffer()
+{
+    thread_local ProfileBuffer *buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.emplace_back(new ProfileBuffer(static_cast<int>(registry.size()) + 1));
+        buffer = registry.back().get();
+    }
+    return *buffer;
+}
+
+bool Profiler::dump(const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Error : can't write trace " << path << std::endl;
+        return false;
+    }
+
+    std::vector<ProfileEvent> events;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const std::unique_ptr<ProfileBuffer> &buffer : registry)
+    {
+        uint64_t end = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = end > ProfileBuffer::capacity ? end - ProfileBuffer::capacity : 0;
+        events.assign(buffer->events, buffer->events + std::min(end, ProfileBuffer::capacity));
+        // The owner kept writing during the copy : drop the slots it may have
+        // overwritten, including the one it could be writing right now
+        uint64_t after = buffer->written.load(std::memory_order_acquire);
+        if (after + 1 > ProfileBuffer::capacity)
+            begin = std::max(begin, after + 1 - ProfileBuffer::capacity);
+
+        out << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+            << ",\"args\":{\"name\":\"" << (buffer->threadId == 1 ? "main" : "worker") << "\"}}";
+        first = false;
+
+        for (uint64_t i = begin; i < end; i++)
+        {
+            const ProfileEvent &e = events[i & (ProfileBuffer::capacity - 1)];
+            out << ",{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+                << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0;
+            if (e.view >= 0)
+                out << ",\"args\":{\"view\":" << e.view << "}";
+            out << "}";
+        }
+    }
+    out << "]}\n";
+    std::cerr << "Trace written to " << path << std::endl;
+    return true;
+}
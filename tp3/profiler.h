@@ -0,0 +1,71 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped CPU timing zones, compiled out unless TP3_PROFILE is defined (qmake CONFIG+=profile).
+// Zone names must be string literals, only the pointer is recorded.
+#ifdef TP3_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, -1)
+#define PROFILE_ZONE_VIEW(name, view) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, view)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_VIEW(name, view)
+#endif
+
+struct ProfileEvent
+{
+    const char *name;
+    int64_t start;      // ns on the steady clock
+    int64_t duration;   // ns
+    int view;           // widget the zone ran for, -1 if none
+};
+
+// Ring written by a single thread without locks, older events get overwritten
+class ProfileBuffer
+{
+public:
+    static const uint64_t capacity = 1 << 16;
+
+    explicit ProfileBuffer(int threadId) : threadId(threadId), written(0) {}
+
+    void push(const ProfileEvent &event)
+    {
+        uint64_t i = written.load(std::memory_order_relaxed);
+        events[i & (capacity - 1)] = event;
+        written.store(i + 1, std::memory_order_release);
+    }
+
+    const int threadId;
+    std::atomic<uint64_t> written;
+    ProfileEvent events[capacity];
+};
+
+namespace Profiler
+{
+    int64_t now();
+    ProfileBuffer &threadBuffer();
+    // Writes every buffered event in Chrome/Perfetto trace format
+    bool dump(const std::string &path);
+}
+
+class ProfileZone
+{
+public:
+    ProfileZone(const char *name, int view) : name(name), view(view), start(Profiler::now()) {}
+    ~ProfileZone()
+    {
+        Profiler::threadBuffer().push({ name, start, Profiler::now() - start, view });
+    }
+
+private:
+    const char *name;
+    int view;
+    int64_t start;
+};
+
+#endif // PROFILER_H
@@ -1,5 +1,6 @@
 #include "quadnode.h"
 #include "mainwidget.h"
+#include "profiler.h"
 #include <QVector2D>
 #include <QVector3D>
 #include <QImage>
@@ -9,7 +10,7 @@
 int QuadNode::startDepth = 8;
 float QuadNode::width = 20.f;
 float QuadNode::height = width;
-int QuadNode::nb_vertices;
+thread_local int QuadNode::nb_vertices;
 float QuadNode::startx = -width / 2.f;
 float QuadNode::starty = width / 2.f;
 float QuadNode::size = width / 2.f;
@@ -49,7 +50,7 @@ float distance(const QVector3D p, float x, float y, float size_x, float size_y)
 }
 
 QuadNode::QuadNode(float x, float y, float size_x, float size_y, int profondeur_max)
-    : x(x), y(y), size_x(size_x), size_y(size_y), profondeur(profondeur_max)
+    : x(x), y(y), size_x(size_x), size_y(size_y), profondeur(profondeur_max), focus(p)
 {
     nb_vertices = 0;
     float c = size_x / 2.f;
@@ -71,10 +72,11 @@ QuadNode::QuadNode(float x, float y, float size_x, float size_y, int profondeur_
     }
 }
 
-QuadNode::QuadNode(float x, float y, float size_x, float size_y, float text_x, float text_y, float size_tx, float size_ty, int profondeur)
-    : x(x), y(y), size_x(size_x), size_y(size_y), text_x(text_x), text_y(text_y),size_tx(size_tx), size_ty(size_ty), profondeur(profondeur)
+QuadNode::QuadNode(float x, float y, float size_x, float size_y, float text_x, float text_y, float size_tx, float size_ty, int profondeur, const QVector3D &focus)
+    : x(x), y(y), size_x(size_x), size_y(size_y), text_x(text_x), text_y(text_y),size_tx(size_tx), size_ty(size_ty), profondeur(profondeur), focus(focus)
 {
-    if (profondeur - distance(QuadNode::p, x, y, size_x, size_y) > 0)
+    bool chunked = startDepth - profondeur < minDepth;
+    if (profondeur > 0 && (chunked || profondeur - distance(focus, x, y, size_x, size_y) > 0))
     {
         this->subdivision();
     }
@@ -93,10 +95,10 @@ void QuadNode::subdivision()
     float d = size_y / 2.f;
     float tx = size_tx / 2.f;
     float ty = size_ty / 2.f;
-    northWest = new QuadNode(x    , y    , c, d, text_x     , text_y     , tx, ty, profondeur - 1);
-    northEast = new QuadNode(x + c, y    , c, d, text_x + tx, text_y     , tx, ty, profondeur - 1);
-    southWest = new QuadNode(x    , y - d, c, d, text_x     , text_y + ty, tx, ty, profondeur - 1);
-    southEast = new QuadNode(x + c, y - d, c, d, text_x + tx, text_y + ty, tx, ty, profondeur - 1);
+    northWest = new QuadNode(x    , y    , c, d, text_x     , text_y     , tx, ty, profondeur - 1, focus);
+    northEast = new QuadNode(x + c, y    , c, d, text_x + tx, text_y     , tx, ty, profondeur - 1, focus);
+    southWest = new QuadNode(x    , y - d, c, d, text_x     , text_y + ty, tx, ty, profondeur - 1, focus);
+    southEast = new QuadNode(x + c, y - d, c, d, text_x + tx, text_y + ty, tx, ty, profondeur - 1, focus);
 }
 
 int clamp(int num, int min, int max)
@@ -106,29 +108,53 @@ int clamp(int num, int min, int max)
     return num;
 }
 
-int QuadNode::iteration(VertexData *vertices, int index)
+// On a line between two chunks
+static bool onChunkBorder(float x, float y)
 {
-    if(profondeur == 0)
-    {
-        float propw = std::abs(startx - x) / QuadNode::width;
-        float proph = std::abs(starty - y) / QuadNode::height;
-
-        vertices[index]     = { QVector3D(x         , y, static_cast<float>(qGray(GeometryEngine::heightMap.pixel(clamp(static_cast<int>(GeometryEngine::width * propw), 0, static_cast<int>(GeometryEngine::width) - 1), clamp(static_cast<int>(GeometryEngine::height * proph), 0, static_cast<int>(GeometryEngine::height) - 1))) / 128.0f * 1.5f + 1.5f)), QVector2D(text_x,text_y)};
-//        vertices[index]     = { QVector3D(x         , y, .0f), QVector2D(text_x,text_y)};
-        propw = std::abs(startx - (x + size_x)) / QuadNode::width;
+    const float cells = static_cast<float>(GeometryEngine::chunkCells());
+    float u = (x - QuadNode::startx) / QuadNode::width * cells;
+    float v = (QuadNode::starty - y) / QuadNode::height * cells;
+    return std::abs(u - std::round(u)) < 1e-4f || std::abs(v - std::round(v)) < 1e-4f;
+}
 
-        vertices[index + 1]     = { QVector3D(x + size_x, y, static_cast<float>(qGray(GeometryEngine::heightMap.pixel(clamp(static_cast<int>(GeometryEngine::width * propw), 0, static_cast<int>(GeometryEngine::width) - 1), clamp(static_cast<int>(GeometryEngine::height * proph), 0, static_cast<int>(GeometryEngine::height) - 1))) / 128.0f * 1.5f + 1.5f)), QVector2D(text_x,text_y)};
-//        vertices[index + 1] = { QVector3D(x + size_x, y, .0f), QVector2D(text_x + size_tx,text_y)};
-        propw = std::abs(startx - x) / QuadNode::width;
-        proph = std::abs(starty - (y - size_y)) / QuadNode::height;
+// Height under (x, y), filtered over the size of the leaves the tree builds around that
+// point : coarse leaves don't alias and corners shared by two leaves get the same height.
+// With GPU displacement, the nearest texel the vertex shader fetches
+float QuadNode::cornerHeight(float x, float y, const QVector3D &focus)
+{
+    float propw = std::abs(QuadNode::startx - x) / QuadNode::width;
+    float proph = std::abs(QuadNode::starty - y) / QuadNode::height;
+    if (GeometryEngine::gpuDisplacement)
+    {
+        const int w = GeometryEngine::heightField.width();
+        const int h = GeometryEngine::heightField.height();
+        return GeometryEngine::heightField.at(clamp(static_cast<int>(propw * w), 0, w - 1), clamp(static_cast<int>(proph * h), 0, h - 1));
+    }
+    // Leaves stop splitting at depth startDepth - distance, each one spans width / 2^depth.
+    // The chunk on the other side of a border may have been built around another focus :
+    // border corners take the finest level whatever the focus, or the two would crack apart
+    float depth = onChunkBorder(x, y) ? QuadNode::startDepth : QuadNode::startDepth - distance(focus, x, y, .0f, .0f);
+    float footprint = (GeometryEngine::width - 1) * std::exp2(-depth);
+    return GeometryEngine::heightPyramid.sample(propw, proph, footprint);
+}
 
-        vertices[index + 2]     = { QVector3D(x         , y - size_y, static_cast<float>(qGray(GeometryEngine::heightMap.pixel(clamp(static_cast<int>(GeometryEngine::width * propw), 0, static_cast<int>(GeometryEngine::width) - 1), clamp(static_cast<int>(GeometryEngine::height * proph), 0, static_cast<int>(GeometryEngine::height) - 1))) / 128.0f * 1.5f + 1.5f)), QVector2D(text_x,text_y)};
-//        vertices[index + 2] = { QVector3D(x         , y - size_y, .0f), QVector2D(text_x,text_y + size_ty)};
-        propw = std::abs(startx - (x + size_x)) / QuadNode::width;
-        proph = std::abs(starty - (y - size_y)) / QuadNode::height;
+// With GPU displacement the vertex shader fetches the height, the CPU skips the lookup
+static float sampleHeight(float x, float y, const QVector3D &focus)
+{
+    if (GeometryEngine::gpuDisplacement)
+        return .0f;
+    return QuadNode::cornerHeight(x, y, focus);
+}
 
-        vertices[index + 3]     = { QVector3D(x + size_x,  y - size_y, static_cast<float>(qGray(GeometryEngine::heightMap.pixel(clamp(static_cast<int>(GeometryEngine::width * propw), 0, static_cast<int>(GeometryEngine::width) - 1), clamp(static_cast<int>(GeometryEngine::height * proph), 0, static_cast<int>(GeometryEngine::height) - 1))) / 128.0f * 1.5f + 1.5f)), QVector2D(text_x,text_y)};
-//        vertices[index + 3] = { QVector3D(x + size_x, y - size_y, 0.f), QVector2D(text_x + size_tx,text_y + size_ty)};
+int QuadNode::iteration(VertexData *vertices, int index)
+{
+    if(profondeur == 0)
+    {
+        // Corners shared with the neighbouring leaves must come out identical to be welded
+        vertices[index]     = { QVector3D(x         , y, sampleHeight(x, y, focus)), QVector2D(text_x,text_y)};
+        vertices[index + 1] = { QVector3D(x + size_x, y, sampleHeight(x + size_x, y, focus)), QVector2D(text_x + size_tx,text_y)};
+        vertices[index + 2] = { QVector3D(x         , y - size_y, sampleHeight(x, y - size_y, focus)), QVector2D(text_x,text_y + size_ty)};
+        vertices[index + 3] = { QVector3D(x + size_x,  y - size_y, sampleHeight(x + size_x, y - size_y, focus)), QVector2D(text_x + size_tx,text_y + size_ty)};
          return index + 4;
     }
     else
@@ -151,26 +177,52 @@ void QuadNode::delQuadNode()
     delete this;
 }
 
-VertexData *getVertices()
+std::vector<VertexData> getVertices(int x, int y, int depth, const QVector3D &focus)
 {
-    QuadNode *root = new QuadNode(.0f, .0f, QuadNode::width, QuadNode::height, QuadNode::startDepth);
-    VertexData *vertices = new VertexData[QuadNode::nb_vertices * 4];
+    PROFILE_ZONE("getVertices");
+    // subdivision(), iteration() and delQuadNode() are recursive : they are timed
+    // at the root so a frame records a handful of events instead of one per node
+    const int cells = 1 << depth;
+    const float size_x = QuadNode::width / cells;
+    const float size_y = QuadNode::height / cells;
+    QuadNode *root;
+    {
+        PROFILE_ZONE("QuadNode::subdivision");
+        QuadNode::nb_vertices = 0;
+        root = new QuadNode(QuadNode::startx + x * size_x, QuadNode::starty - y * size_y, size_x, size_y,
+                            static_cast<float>(x) / cells, static_cast<float>(y) / cells, 1.f / cells, 1.f / cells,
+                            QuadNode::startDepth - depth, focus);
+    }
+    std::vector<VertexData> vertices(QuadNode::nb_vertices * 4);
 //    std::cout << "nb_vertices = " << QuadNode::nb_vertices << std::endl;
     int index = 0;
-    index = root->iteration(vertices, index);
+    {
+        PROFILE_ZONE("QuadNode::iteration");
+        index = root->iteration(vertices.data(), index);
+    }
 //    std::cout << "index de sorti = " << index << std::endl;
-    root->delQuadNode();
+    {
+        PROFILE_ZONE("QuadNode::delQuadNode");
+        root->delQuadNode();
+    }
     return vertices;
 }
 
+QVector3D nextFocus(const QVector3D &p)
+{
+    QVector3D next = p;
+    if (!qFuzzyCompare(p.x(), QuadNode::startx / 2.f + QuadNode::size) && qFuzzyCompare(p.y(), QuadNode::starty / 2.f))
+        next.setX(p.x() + .1f);
+    else if (qFuzzyCompare(p.x(), QuadNode::startx / 2.f + QuadNode::size) && !qFuzzyCompare(p.y(), QuadNode::starty / 2.f - QuadNode::size))
+        next.setY(p.y() - .1f);
+    else if (!qFuzzyCompare(p.x(), QuadNode::startx / 2.f) && qFuzzyCompare(p.y(), QuadNode::starty / 2.f - QuadNode::size))
+        next.setX(p.x() - .1f);
+    else if (qFuzzyCompare(p.x(), QuadNode::startx / 2.f) && !qFuzzyCompare(p.y(), QuadNode::starty / 2.f))
+        next.setY(p.y() + .1f);
+    return next;
+}
+
 void autoMovePoint()
 {
-    if (!qFuzzyCompare(QuadNode::p.x(), QuadNode::startx / 2.f + QuadNode::size) && qFuzzyCompare(QuadNode::p.y(), QuadNode::starty / 2.f))
-        QuadNode::p.setX(QuadNode::p.x() + .1f);
-    else if (qFuzzyCompare(QuadNode::p.x(), QuadNode::startx / 2.f + QuadNode::size) && !qFuzzyCompare(QuadNode::p.y(), QuadNode::starty / 2.f - QuadNode::size))
-        QuadNode::p.setY(QuadNode::p.y() - .1f);
-    else if (!qFuzzyCompare(QuadNode::p.x(), QuadNode::startx / 2.f) && qFuzzyCompare(QuadNode::p.y(), QuadNode::starty / 2.f - QuadNode::size))
-        QuadNode::p.setX(QuadNode::p.x() - .1f);
-    else if (qFuzzyCompare(QuadNode::p.x(), QuadNode::startx / 2.f) && !qFuzzyCompare(QuadNode::p.y(), QuadNode::starty / 2.f))
-        QuadNode::p.setY(QuadNode::p.y() + .1f);
+    QuadNode::p = nextFocus(QuadNode::p);
 }
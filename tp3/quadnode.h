@@ -6,20 +6,32 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
+#include <vector>
 
-VertexData *getVertices();
+// Leaves under the node at column x, row y of the nodes of depth depth, four vertices each,
+// split around focus. Safe on any thread while the QuadNode parameters don't change
+std::vector<VertexData> getVertices(int x, int y, int depth, const QVector3D &focus);
 int clamp(int num, int min, int max);
 float distance(QVector3D p, float x, float y, float size_x, float size_y);
+// Focus point one simulation step after p, on the square autoMovePoint() follows
+QVector3D nextFocus(const QVector3D &p);
 void autoMovePoint();
 
 class QuadNode
 {
 public:
     QuadNode(float x, float y, float size_x, float size_y, int profondeur_max);
-    QuadNode(float x, float y, float size_x, float size_y, float text_x, float text_y, float size_tx, float size_ty, int profondeur);
+    QuadNode(float x, float y, float size_x, float size_y, float text_x, float text_y, float size_tx, float size_ty, int profondeur, const QVector3D &focus);
     void delQuadNode();
     int iteration(VertexData *vertices, int index);
-    int static nb_vertices, startDepth;
+    // Height of a leaf corner at (x, y) as drawn in a tree split around focus, by the CPU
+    // build or the vertex shader
+    static float cornerHeight(float x, float y, const QVector3D &focus);
+    int static startDepth;
+    // Leaves counted by the constructors, per thread : chunks are also built on workers
+    static thread_local int nb_vertices;
+    // Nodes above the chunks always split : every chunk is built from its own node
+    static const int minDepth = GeometryEngine::chunkDepth;
     float static width, height;
     float static startx, starty, size, maxDist;
     QVector3D static p;
@@ -38,6 +50,7 @@ private:
     float size_tx;
     float size_ty;
     int profondeur;
+    QVector3D focus;
     QuadNode *northWest;
     QuadNode *northEast;
     QuadNode *southWest;
@@ -0,0 +1,60 @@
+#include "seasonswidget.h"
+#include "profiler.h"
+
+SeasonsWidget::SeasonsWidget(double fps, QWidget *parent)
+    : MainWidget(fps, Season::Printemps, parent), viewportWidth(0), viewportHeight(0)
+{
+    updateSeason();
+}
+
+void SeasonsWidget::resizeGL(int w, int h)
+{
+    // Each quadrant keeps the aspect ratio of the whole window
+    MainWidget::resizeGL(w, h);
+
+    viewportWidth = static_cast<int>(w * devicePixelRatioF()) / 2;
+    viewportHeight = static_cast<int>(h * devicePixelRatioF()) / 2;
+}
+
+void SeasonsWidget::paintGL()
+{
+    PROFILE_ZONE("SeasonsWidget::paintGL");
+    if (geometries == nullptr)
+    {
+        drawPlaceholder();
+        return;
+    }
+    beginFrame();
+
+    float buildMs = buildTerrain();
+
+    // Terrain buffers are bound once, only the season colour changes between viewports
+    stats->beginStage(GpuStage::Terrain);
+    for (int i = 0; i < 4; i++)
+    {
+        glViewport((i % 2) * viewportWidth, (1 - i / 2) * viewportHeight, viewportWidth, viewportHeight);
+        drawTerrain(seasonColor(seasonAfter(season, i)), i);
+    }
+    stats->endStage();
+
+    glViewport(0, 0, viewportWidth * 2, viewportHeight * 2);
+    endFrame(buildMs);
+}
+
+QRect SeasonsWidget::viewportAt(const QPoint &pos) const
+{
+    int w = width() / 2;
+    int h = height() / 2;
+    return QRect(pos.x() < w ? 0 : w, pos.y() < h ? 0 : h, w, h);
+}
+
+int SeasonsWidget::viewCount() const
+{
+    return 4;
+}
+
+void SeasonsWidget::updateSeason()
+{
+    setWindowTitle(QString("Saisons : %1").arg(seasonName(season)));
+    markDirty(DirtySeason);
+}
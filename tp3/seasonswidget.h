@@ -0,0 +1,27 @@
+#ifndef SEASONSWIDGET_H
+#define SEASONSWIDGET_H
+
+#include "mainwidget.h"
+
+// Draws the four seasons as the four viewports of a single window : one context,
+// one timer, one swap and one terrain build per frame
+class SeasonsWidget : public MainWidget
+{
+    Q_OBJECT
+
+public:
+    explicit SeasonsWidget(double fps, QWidget *parent = nullptr);
+
+protected:
+    void resizeGL(int w, int h) override;
+    void paintGL() override;
+    void updateSeason() override;
+    int viewCount() const override;
+    QRect viewportAt(const QPoint &pos) const override;
+
+private:
+    int viewportWidth;
+    int viewportHeight;
+};
+
+#endif // SEASONSWIDGET_H
@@ -0,0 +1,270 @@
+#include "shaderlibrary.h"
+#include "geometryengine.h"
+#include "uniformbuffers.h"
+#include "quadnode.h"
+#include "profiler.h"
+
+#include <QFile>
+#include <QOpenGLContext>
+#include <QVector2D>
+#include <QVector4D>
+#include <iostream>
+
+// KHR_parallel_shader_compile, same value as the ARB token
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+QHash<QString, ShaderLibrary::Entry> ShaderLibrary::programs;
+bool ShaderLibrary::parallelChecked = false;
+bool ShaderLibrary::parallel = false;
+
+QString ShaderLibrary::key(const QString &vertexPath, const QString &geometryPath, const QString &fragmentPath, int features)
+{
+    return QString("%1|%2|%3|%4").arg(vertexPath, geometryPath, fragmentPath).arg(features);
+}
+
+QOpenGLShaderProgram *ShaderLibrary::acquire(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                             const QString &fragmentPath, int features)
+{
+    QString name = key(vertexPath, geometryPath, fragmentPath, features);
+    if (programs.contains(name))
+    {
+        Entry &entry = programs[name];
+        if (entry.linking && !finishBuild(gl, entry))
+        {
+            programs.remove(name);
+            return nullptr;
+        }
+        entry.users++;
+        return entry.program;
+    }
+
+    QOpenGLShaderProgram *program = build(gl, vertexPath, geometryPath, fragmentPath, features);
+    if (program != nullptr)
+        programs.insert(name, { program, 1, false });
+    return program;
+}
+
+void ShaderLibrary::prepare(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                            const QString &fragmentPath, int features)
+{
+    QString name = key(vertexPath, geometryPath, fragmentPath, features);
+    if (programs.contains(name))
+        return;
+
+    // One user of its own : release() never deletes it
+    bool background = enableParallelCompile();
+    QOpenGLShaderProgram *program = background ? startBuild(gl, vertexPath, geometryPath, fragmentPath, features)
+                                               : build(gl, vertexPath, geometryPath, fragmentPath, features);
+    if (program != nullptr)
+        programs.insert(name, { program, 1, background });
+}
+
+bool ShaderLibrary::isLinked(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                             const QString &fragmentPath, int features)
+{
+    // Not prepared, acquire() builds it the usual way
+    auto it = programs.find(key(vertexPath, geometryPath, fragmentPath, features));
+    if (it == programs.end() || !it->linking)
+        return true;
+
+    GLint complete = 0;
+    gl->glGetProgramiv(it->program->programId(), GL_COMPLETION_STATUS_KHR, &complete);
+    if (complete == 0)
+        return false;
+    // Done : reading the status no longer waits. After a failure acquire() builds it again
+    if (!finishBuild(gl, *it))
+        programs.erase(it);
+    return true;
+}
+
+void ShaderLibrary::release(QOpenGLShaderProgram *program)
+{
+    // The last user must have a context of the share group current
+    for (auto it = programs.begin(); it != programs.end(); ++it)
+    {
+        if (it->program != program)
+            continue;
+        if (--it->users == 0)
+        {
+            delete it->program;
+            programs.erase(it);
+        }
+        return;
+    }
+}
+
+QByteArray ShaderLibrary::specialise(const QString &path, int features)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QByteArray source = file.readAll();
+
+    QByteArray defines;
+    if (features & ShaderTextured)
+        defines += "#define TEXTURED\n";
+    if (features & ShaderPrecombinedMvp)
+        defines += "#define PRECOMBINED_MVP\n";
+    if (features & ShaderGpuDisplacement)
+        defines += "#define GPU_DISPLACEMENT\n";
+    if (features & ShaderPackedVertices)
+        defines += "#define PACKED_VERTICES\n";
+    if (features & ShaderWireframe)
+        defines += "#define WIREFRAME\n";
+    if (features & ShaderWireFill)
+        defines += "#define WIRE_FILL\n";
+
+    // #version must stay the first directive
+    int at = 0;
+    if (source.startsWith("#version"))
+        at = source.indexOf('\n') + 1;
+    return source.insert(at, defines);
+}
+
+QOpenGLShaderProgram *ShaderLibrary::build(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                           const QString &fragmentPath, int features)
+{
+    PROFILE_ZONE("ShaderLibrary::build");
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+    QByteArray vertexSource = specialise(vertexPath, features);
+    QByteArray fragmentSource = specialise(fragmentPath, features);
+    QByteArray geometrySource = geometryPath.isEmpty() ? QByteArray() : specialise(geometryPath, features);
+
+    // Cacheable shaders are only compiled by link(), and only if no binary matches
+    if (vertexSource.isEmpty() || fragmentSource.isEmpty() || (!geometryPath.isEmpty() && geometrySource.isEmpty())
+            || !program->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, vertexSource)
+            || (!geometryPath.isEmpty() && !program->addCacheableShaderFromSourceCode(QOpenGLShader::Geometry, geometrySource))
+            || !program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource))
+    {
+        std::cerr << "Error : can't load " << vertexPath.toStdString() << " / " << geometryPath.toStdString()
+                  << " / " << fragmentPath.toStdString() << std::endl;
+        delete program;
+        return nullptr;
+    }
+
+    // Fixed attribute locations, the geometry engine never looks them up
+    program->bindAttributeLocation("a_position", GeometryEngine::positionLocation);
+    program->bindAttributeLocation("a_texcoord", GeometryEngine::texcoordLocation);
+
+    // Link shader pipeline
+    if (!program->link())
+    {
+        std::cerr << "Error : " << program->log().toStdString() << std::endl;
+        delete program;
+        return nullptr;
+    }
+
+    setUp(gl, program);
+    return program;
+}
+
+QOpenGLShaderProgram *ShaderLibrary::startBuild(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                                const QString &fragmentPath, int features)
+{
+    PROFILE_ZONE("ShaderLibrary::startBuild");
+    QByteArray vertexSource = specialise(vertexPath, features);
+    QByteArray fragmentSource = specialise(fragmentPath, features);
+    QByteArray geometrySource = geometryPath.isEmpty() ? QByteArray() : specialise(geometryPath, features);
+    if (vertexSource.isEmpty() || fragmentSource.isEmpty() || (!geometryPath.isEmpty() && geometrySource.isEmpty()))
+    {
+        std::cerr << "Error : can't load " << vertexPath.toStdString() << " / " << geometryPath.toStdString()
+                  << " / " << fragmentPath.toStdString() << std::endl;
+        return nullptr;
+    }
+
+    // QOpenGLShader and link() read the compile and link status back, which waits for the
+    // driver : the stages are attached by hand, link() only runs once the program completed
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+    program->create();
+    const GLuint id = program->programId();
+    auto attach = [gl, id](GLenum type, const QByteArray &source)
+    {
+        GLuint shader = gl->glCreateShader(type);
+        const char *text = source.constData();
+        gl->glShaderSource(shader, 1, &text, nullptr);
+        gl->glCompileShader(shader);
+        gl->glAttachShader(id, shader);
+        // Freed with the program
+        gl->glDeleteShader(shader);
+    };
+    attach(GL_VERTEX_SHADER, vertexSource);
+    if (!geometryPath.isEmpty())
+        attach(GL_GEOMETRY_SHADER, geometrySource);
+    attach(GL_FRAGMENT_SHADER, fragmentSource);
+
+    gl->glBindAttribLocation(id, GeometryEngine::positionLocation, "a_position");
+    gl->glBindAttribLocation(id, GeometryEngine::texcoordLocation, "a_texcoord");
+    gl->glLinkProgram(id);
+    return program;
+}
+
+bool ShaderLibrary::finishBuild(QOpenGLFunctions_4_5_Core *gl, Entry &entry)
+{
+    PROFILE_ZONE("ShaderLibrary::finishBuild");
+    entry.linking = false;
+    // Without shaders of its own, link() takes the status of the program as it is
+    GLint linked = 0;
+    const GLuint id = entry.program->programId();
+    gl->glGetProgramiv(id, GL_LINK_STATUS, &linked);
+    if (linked == 0 || !entry.program->link())
+    {
+        // The compile errors are in the logs of the stages
+        GLuint shaders[3];
+        GLsizei count = 0;
+        gl->glGetAttachedShaders(id, 3, &count, shaders);
+        for (GLsizei i = 0; i < count; i++)
+        {
+            char log[1024] = "";
+            gl->glGetShaderInfoLog(shaders[i], sizeof(log), nullptr, log);
+            if (log[0] != '\0')
+                std::cerr << "Error : " << log << std::endl;
+        }
+        char log[1024] = "";
+        gl->glGetProgramInfoLog(id, sizeof(log), nullptr, log);
+        std::cerr << "Error : " << log << std::endl;
+        delete entry.program;
+        entry.program = nullptr;
+        return false;
+    }
+
+    setUp(gl, entry.program);
+    return true;
+}
+
+void ShaderLibrary::setUp(QOpenGLFunctions_4_5_Core *gl, QOpenGLShaderProgram *program)
+{
+    bindUniformBlocks(gl, program->programId());
+
+    // Constant for the program's lifetime : set once, unused ones are ignored
+    program->bind();
+    program->setUniformValue("u_texture", 0);
+    program->setUniformValue("u_heightmap", 1);
+    program->setUniformValue("u_terrain", QVector4D(QuadNode::startx, QuadNode::starty, QuadNode::width, QuadNode::height));
+    program->setUniformValue("u_height", QVector2D(GeometryEngine::heightScale, GeometryEngine::heightBias));
+}
+
+bool ShaderLibrary::enableParallelCompile()
+{
+    if (parallelChecked)
+        return parallel;
+    parallelChecked = true;
+
+    // Let the driver compile on its own threads, as many as it wants
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context == nullptr)
+        return parallel;
+    typedef void (*MaxThreads)(GLuint);
+    MaxThreads maxThreads = nullptr;
+    if (context->hasExtension("GL_KHR_parallel_shader_compile"))
+        maxThreads = reinterpret_cast<MaxThreads>(context->getProcAddress("glMaxShaderCompilerThreadsKHR"));
+    else if (context->hasExtension("GL_ARB_parallel_shader_compile"))
+        maxThreads = reinterpret_cast<MaxThreads>(context->getProcAddress("glMaxShaderCompilerThreadsARB"));
+    if (maxThreads != nullptr)
+    {
+        maxThreads(0xFFFFFFFF);
+        parallel = true;
+    }
+    return parallel;
+}
@@ -0,0 +1,72 @@
+#ifndef SHADERLIBRARY_H
+#define SHADERLIBRARY_H
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLShaderProgram>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// Features a program is specialised for, each one becomes a #define in every stage
+enum ShaderFeature
+{
+    ShaderTextured = 1,         // TEXTURED : sample u_texture, otherwise the colour alone
+    ShaderPrecombinedMvp = 2,   // PRECOMBINED_MVP : one matrix product per vertex instead of three
+    ShaderGpuDisplacement = 4,  // GPU_DISPLACEMENT : height fetched from u_heightmap by the vertex shader
+    ShaderPackedVertices = 8,   // PACKED_VERTICES : normalized 16 bit vertices, expanded with u_terrain
+    ShaderWireframe = 16,       // WIREFRAME : barycentric edges drawn in the fill pass, needs the geometry stage
+    ShaderWireFill = 32         // WIRE_FILL : faces filled under the wireframe instead of discarded
+};
+
+// Programs are shared by every context of the share group : each variant is compiled once.
+// With KHR/ARB_parallel_shader_compile, prepare() hands the variants to the driver's compiler
+// threads up front and isLinked() polls them without waiting. Otherwise they're built on first
+// use, and their binaries are kept in Qt's disk cache (keyed by source and driver)
+class ShaderLibrary
+{
+public:
+    // Linked variant with our attribute locations and uniform blocks, nullptr on failure.
+    // A context of the share group must be current. Waits for a prepared variant still linking
+    // The geometry stage is optional, pass an empty path to skip it
+    static QOpenGLShaderProgram *acquire(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                         const QString &fragmentPath, int features);
+    static void release(QOpenGLShaderProgram *program);
+
+    // Starts compiling and linking a variant without waiting for the result, built right away
+    // without the extension. Prepared variants are kept until exit
+    static void prepare(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                        const QString &fragmentPath, int features);
+    // Never blocks : false while the driver still links a prepared variant, acquire() would wait
+    static bool isLinked(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                         const QString &fragmentPath, int features);
+
+private:
+    struct Entry
+    {
+        QOpenGLShaderProgram *program;
+        int users;
+        // Handed to the driver by prepare(), link status not read yet
+        bool linking;
+    };
+
+    static QString key(const QString &vertexPath, const QString &geometryPath, const QString &fragmentPath, int features);
+    static QOpenGLShaderProgram *build(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                       const QString &fragmentPath, int features);
+    // Compiles and links with plain GL calls, none of which reads a status back
+    static QOpenGLShaderProgram *startBuild(QOpenGLFunctions_4_5_Core *gl, const QString &vertexPath, const QString &geometryPath,
+                                            const QString &fragmentPath, int features);
+    // Reads the link status of a started build, waiting if needed. False, entry deleted, on failure
+    static bool finishBuild(QOpenGLFunctions_4_5_Core *gl, Entry &entry);
+    // Uniform blocks and constant uniforms of a linked program
+    static void setUp(QOpenGLFunctions_4_5_Core *gl, QOpenGLShaderProgram *program);
+    // Raises the driver's compiler thread count once, true if it compiles in the background
+    static bool enableParallelCompile();
+    // Source of the file with the feature #defines inserted after its #version line
+    static QByteArray specialise(const QString &path, int features);
+
+    static QHash<QString, Entry> programs;
+    static bool parallelChecked;
+    static bool parallel;
+};
+
+#endif // SHADERLIBRARY_H
@@ -0,0 +1,48 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <QElapsedTimer>
+
+#include <functional>
+#include <vector>
+
+// Fixed timestep update loop : the steps run at the same rate whatever the
+// render rate, views interpolate between the last two states with alpha()
+class Simulation
+{
+public:
+    typedef std::function<void()> Step;
+
+    static const int rate = 60;
+    // Steps run in one update at most, the rest of a long stall is dropped
+    static const int maxSteps = 8;
+
+    static Simulation *instance();
+
+    int add(const Step &step);
+    void remove(int id);
+
+    // Runs every step that became due since the last call
+    void update();
+    // Fraction of a step elapsed since the last one, in [0, 1]
+    float alpha() const;
+    static float dt();
+    quint64 stepCount() const;
+
+private:
+    Simulation();
+
+    struct Entry
+    {
+        int id;
+        Step step;
+    };
+
+    std::vector<Entry> steps;
+    int nextId;
+    QElapsedTimer clock;
+    qint64 simulated;   // ns of simulated time
+    quint64 count;
+};
+
+#endif // SIMULATION_H
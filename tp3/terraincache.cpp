@@ -0,0 +1,260 @@
+#include "terraincache.h"
+#include "quadnode.h"
+#include "profiler.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+    // Bump when the layout of any section changes
+    const quint32 version = 4;
+    const char magic[8] = { 'T', 'P', '3', 'T', 'E', 'R', 'R', 0 };
+    // Sections start on 16 bytes, SSE loads can read them in place
+    const qint64 alignment = 16;
+
+    static_assert(sizeof(QVector3D) == 3 * sizeof(float), "normals are stored as QVector3D");
+    static_assert(sizeof(VertexData) == 5 * sizeof(float), "vertices are stored as VertexData");
+    static_assert(sizeof(HeightRange) == 2 * sizeof(float), "ranges are stored as HeightRange");
+    static_assert(sizeof(TerrainChunk) == 8 * sizeof(float), "chunks are stored as TerrainChunk");
+
+    // Native endianness : the file never leaves the machine that baked it
+    struct FileHeader
+    {
+        char magic[8];
+        quint32 version;
+        quint32 sectionCount;
+        char sourceHash[20];
+        qint32 width;
+        qint32 height;
+        // QuadNode parameters of the normals and the mesh
+        qint32 startDepth;
+        float terrainWidth;
+        float terrainHeight;
+        float maxDist;
+        // TerrainMesh fields
+        float focus[3];
+        quint32 displaced;
+        quint32 optimized;
+        float acmrGenerated;
+        float acmrDrawn;
+        quint32 pyramidLevels;
+        quint32 rangeLevels;
+    };
+
+    struct Section
+    {
+        quint64 offset;
+        quint64 bytes;
+        qint32 width;
+        qint32 height;
+    };
+
+    // Fixed sections, then the pyramid levels, then the range levels
+    enum { HeightsSection, NormalsSection, VerticesSection, IndicesSection, ChunksSection, FixedSections };
+
+    // Kept open while the views on it are used
+    std::unique_ptr<QFile> mapped;
+
+    qint64 aligned(qint64 offset)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    bool sameParameters(const FileHeader &header)
+    {
+        return header.startDepth == QuadNode::startDepth && header.terrainWidth == QuadNode::width
+            && header.terrainHeight == QuadNode::height && header.maxDist == QuadNode::maxDist;
+    }
+
+    // Section of count elements of T, inside the file
+    template <typename T>
+    const T *view(const uchar *file, qint64 fileSize, const Section &section, size_t count)
+    {
+        if (section.bytes != count * sizeof(T) || section.offset % alignment != 0
+                || section.offset + section.bytes > static_cast<quint64>(fileSize))
+            return nullptr;
+        return reinterpret_cast<const T *>(file + section.offset);
+    }
+}
+
+QString TerrainCache::pathFor(const QString &source)
+{
+    // Nothing can be written next to a resource compiled in the executable
+    if (!source.startsWith(":"))
+        return source + ".terrain";
+    QDir cache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    cache.mkpath(".");
+    return cache.filePath(QFileInfo(source).completeBaseName() + ".terrain");
+}
+
+QByteArray TerrainCache::sourceHash(const QString &source)
+{
+    QFile file(source);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+    return QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1);
+}
+
+bool TerrainCache::load(const QString &source, const QByteArray &hash, Contents &contents)
+{
+    PROFILE_ZONE("TerrainCache::load");
+    std::unique_ptr<QFile> file(new QFile(pathFor(source)));
+    if (!file->open(QFile::ReadOnly) || file->size() < static_cast<qint64>(sizeof(FileHeader)))
+        return false;
+    const qint64 fileSize = file->size();
+    const uchar *memory = file->map(0, fileSize);
+    if (memory == nullptr)
+        return false;
+
+    FileHeader header;
+    std::memcpy(&header, memory, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version
+            || hash.size() != sizeof(header.sourceHash) || std::memcmp(header.sourceHash, hash.constData(), sizeof(header.sourceHash)) != 0
+            || !sameParameters(header)
+            || header.sectionCount != FixedSections + header.pyramidLevels + header.rangeLevels
+            || sizeof(FileHeader) + header.sectionCount * sizeof(Section) > static_cast<quint64>(fileSize))
+        return false;
+    std::vector<Section> sections(header.sectionCount);
+    std::memcpy(sections.data(), memory + sizeof(FileHeader), sections.size() * sizeof(Section));
+
+    const size_t samples = static_cast<size_t>(header.width) * header.height;
+    const quint8 *heights = view<quint8>(memory, fileSize, sections[HeightsSection], samples);
+    const QVector3D *normals = view<QVector3D>(memory, fileSize, sections[NormalsSection], samples);
+    const Section &vertexSection = sections[VerticesSection];
+    const Section &indexSection = sections[IndicesSection];
+    const VertexData *vertices = view<VertexData>(memory, fileSize, vertexSection, static_cast<size_t>(vertexSection.width));
+    const GLuint *indices = view<GLuint>(memory, fileSize, indexSection, static_cast<size_t>(indexSection.width));
+    const Section &chunkSection = sections[ChunksSection];
+    const TerrainChunk *chunks = view<TerrainChunk>(memory, fileSize, chunkSection, static_cast<size_t>(chunkSection.width));
+    if (heights == nullptr || normals == nullptr || vertices == nullptr || indices == nullptr || chunks == nullptr)
+        return false;
+
+    Contents baked;
+    baked.heights = HeightField<quint8, RowMajorLayout, TerrainRange>(header.width, header.height, heights);
+    baked.normals = SampleStore<QVector3D>(normals, samples);
+    for (quint32 i = 0; i < header.pyramidLevels; i++)
+    {
+        const Section &section = sections[FixedSections + i];
+        const float *level = view<float>(memory, fileSize, section, TiledLayout(section.width, section.height).size());
+        if (level == nullptr)
+            return false;
+        baked.pyramid.emplace_back(section.width, section.height, level);
+    }
+    for (quint32 i = 0; i < header.rangeLevels; i++)
+    {
+        const Section &section = sections[FixedSections + header.pyramidLevels + i];
+        size_t count = static_cast<size_t>(section.width) * section.height;
+        const HeightRange *level = view<HeightRange>(memory, fileSize, section, count);
+        if (level == nullptr)
+            return false;
+        MinMaxPyramid::Level ranges;
+        ranges.width = section.width;
+        ranges.height = section.height;
+        ranges.ranges = SampleStore<HeightRange>(level, count);
+        baked.ranges.push_back(std::move(ranges));
+    }
+
+    // The mesh is uploaded from a vector, it is the one section copied
+    baked.mesh.vertices.assign(vertices, vertices + vertexSection.width);
+    baked.mesh.indices.assign(indices, indices + indexSection.width);
+    baked.mesh.chunks.assign(chunks, chunks + chunkSection.width);
+    baked.mesh.focus = QVector3D(header.focus[0], header.focus[1], header.focus[2]);
+    baked.mesh.displaced = header.displaced != 0;
+    baked.mesh.optimized = header.optimized != 0;
+    baked.mesh.acmrGenerated = header.acmrGenerated;
+    baked.mesh.acmrDrawn = header.acmrDrawn;
+
+    contents = std::move(baked);
+    mapped = std::move(file);
+    return true;
+}
+
+bool TerrainCache::save(const QString &source, const QByteArray &hash,
+                        const HeightField<quint8, RowMajorLayout, TerrainRange> &heights, const HeightPyramid &pyramid,
+                        const MinMaxPyramid &ranges, const SampleStore<QVector3D> &normals, const TerrainMesh &mesh)
+{
+    PROFILE_ZONE("TerrainCache::save");
+    if (heights.isNull() || hash.size() != sizeof(FileHeader::sourceHash))
+        return false;
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    std::memcpy(header.sourceHash, hash.constData(), sizeof(header.sourceHash));
+    header.width = heights.width();
+    header.height = heights.height();
+    header.startDepth = QuadNode::startDepth;
+    header.terrainWidth = QuadNode::width;
+    header.terrainHeight = QuadNode::height;
+    header.maxDist = QuadNode::maxDist;
+    header.focus[0] = mesh.focus.x();
+    header.focus[1] = mesh.focus.y();
+    header.focus[2] = mesh.focus.z();
+    header.displaced = mesh.displaced;
+    header.optimized = mesh.optimized;
+    header.acmrGenerated = mesh.acmrGenerated;
+    header.acmrDrawn = mesh.acmrDrawn;
+    header.pyramidLevels = static_cast<quint32>(pyramid.levelCount());
+    header.rangeLevels = static_cast<quint32>(ranges.levelCount());
+    header.sectionCount = FixedSections + header.pyramidLevels + header.rangeLevels;
+
+    // Contents of every section, laid out one after the other past the section table
+    std::vector<const void *> data;
+    std::vector<Section> sections;
+    qint64 offset = aligned(sizeof(FileHeader) + header.sectionCount * sizeof(Section));
+    auto add = [&](const void *bytes, size_t size, int width, int height)
+    {
+        data.push_back(bytes);
+        sections.push_back({ static_cast<quint64>(offset), size, width, height });
+        offset = aligned(offset + static_cast<qint64>(size));
+    };
+    add(heights.data(), heights.layout().size(), heights.width(), heights.height());
+    add(normals.data(), normals.size() * sizeof(QVector3D), heights.width(), heights.height());
+    // Element counts in the width of the mesh sections
+    add(mesh.vertices.data(), mesh.vertices.size() * sizeof(VertexData), static_cast<int>(mesh.vertices.size()), 1);
+    add(mesh.indices.data(), mesh.indices.size() * sizeof(GLuint), static_cast<int>(mesh.indices.size()), 1);
+    add(mesh.chunks.data(), mesh.chunks.size() * sizeof(TerrainChunk), static_cast<int>(mesh.chunks.size()), 1);
+    for (int i = 0; i < pyramid.levelCount(); i++)
+    {
+        const HeightPyramid::Level &level = pyramid.level(i);
+        add(level.data(), level.layout().size() * sizeof(float), level.width(), level.height());
+    }
+    for (int i = 0; i < ranges.levelCount(); i++)
+    {
+        const MinMaxPyramid::Level &level = ranges.level(i);
+        add(level.ranges.data(), level.ranges.size() * sizeof(HeightRange), level.width, level.height);
+    }
+
+    // Written aside and renamed over the old file on commit : a reader never maps half a file
+    const QString path = pathFor(source);
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly))
+    {
+        std::cerr << "Error : can't write " << path.toStdString() << std::endl;
+        return false;
+    }
+    const char padding[alignment] = {};
+    qint64 written = file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    written += file.write(reinterpret_cast<const char *>(sections.data()), static_cast<qint64>(sections.size() * sizeof(Section)));
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        written += file.write(padding, static_cast<qint64>(sections[i].offset) - written);
+        written += file.write(static_cast<const char *>(data[i]), static_cast<qint64>(sections[i].bytes));
+    }
+    if (!file.commit())
+    {
+        std::cerr << "Error : can't write " << path.toStdString() << std::endl;
+        return false;
+    }
+    std::cerr << "Baked terrain to " << path.toStdString() << " (" << written << " bytes)" << std::endl;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef TERRAINCACHE_H
+#define TERRAINCACHE_H
+
+#include "geometryengine.h"
+#include "minmaxpyramid.h"
+
+#include <QByteArray>
+#include <QString>
+
+// Decoded heights and everything derived from them, baked into one file mapped on the next
+// runs instead of decoding the image again. The file is only valid for the bytes of the
+// source image and the QuadNode parameters it was baked with
+namespace TerrainCache
+{
+    // Views on the mapped file, valid until the process exits. The mesh is copied out
+    struct Contents
+    {
+        HeightField<quint8, RowMajorLayout, TerrainRange> heights;
+        std::vector<HeightPyramid::Level> pyramid;
+        std::vector<MinMaxPyramid::Level> ranges;
+        SampleStore<QVector3D> normals;
+        TerrainMesh mesh;
+    };
+
+    // Next to a source on disk, in the cache directory for a Qt resource
+    QString pathFor(const QString &source);
+    // Sha1 of the source bytes, empty if it can't be read
+    QByteArray sourceHash(const QString &source);
+
+    // False if the file is missing, stale or damaged
+    bool load(const QString &source, const QByteArray &hash, Contents &contents);
+    bool save(const QString &source, const QByteArray &hash,
+              const HeightField<quint8, RowMajorLayout, TerrainRange> &heights, const HeightPyramid &pyramid,
+              const MinMaxPyramid &ranges, const SampleStore<QVector3D> &normals, const TerrainMesh &mesh);
+}
+
+#endif // TERRAINCACHE_H
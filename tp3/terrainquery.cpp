@@ -0,0 +1,547 @@
+#include "terrainquery.h"
+#include "geometryengine.h"
+#include "quadnode.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // North-west corner and size of a leaf, and the focus point its tree was split around,
+    // as QuadNode stores them
+    struct Leaf
+    {
+        float x;
+        float y;
+        float sizeX;
+        float sizeY;
+        QVector3D focus;
+    };
+
+    float clampX(float x)
+    {
+        return qBound(QuadNode::startx, x, QuadNode::startx + QuadNode::width);
+    }
+
+    float clampY(float y)
+    {
+        return qBound(QuadNode::starty - QuadNode::height, y, QuadNode::starty);
+    }
+
+    // Same descent as the QuadNode constructors : the nodes above QuadNode::minDepth always
+    // split, a node of depth k while k - distance(focus, node) > 0, around the focus point
+    // the drawn chunk holding (x, y) was built for
+    Leaf leafAt(float x, float y)
+    {
+        Leaf node = { QuadNode::startx, QuadNode::starty, QuadNode::width, QuadNode::height, GeometryEngine::drawnFocus(x, y) };
+        for (int depth = QuadNode::startDepth - 1; depth >= 0; depth--)
+        {
+            node.sizeX /= 2.f;
+            node.sizeY /= 2.f;
+            if (x >= node.x + node.sizeX)
+                node.x += node.sizeX;
+            if (y <= node.y - node.sizeY)
+                node.y -= node.sizeY;
+            if (QuadNode::startDepth - depth >= QuadNode::minDepth
+                    && depth - distance(node.focus, node.x, node.y, node.sizeX, node.sizeY) <= 0)
+                break;
+        }
+        return node;
+    }
+
+    // Corners in the order of QuadNode::iteration() : north-west, north-east, south-west, south-east
+    void cornerHeights(const Leaf &leaf, float heights[4])
+    {
+        heights[0] = QuadNode::cornerHeight(leaf.x, leaf.y, leaf.focus);
+        heights[1] = QuadNode::cornerHeight(leaf.x + leaf.sizeX, leaf.y, leaf.focus);
+        heights[2] = QuadNode::cornerHeight(leaf.x, leaf.y - leaf.sizeY, leaf.focus);
+        heights[3] = QuadNode::cornerHeight(leaf.x + leaf.sizeX, leaf.y - leaf.sizeY, leaf.focus);
+    }
+
+    // Slopes along the leaf, per unit of fx and fy, of the triangle holding (fx, fy).
+    // The leaf is split along its north-west to south-east diagonal, see GeometryEngine::buildMesh()
+    void triangleSlopes(const float heights[4], float fx, float fy, float &slopeX, float &slopeY)
+    {
+        if (fy >= fx)
+        {
+            // North-west, south-west, south-east
+            slopeX = heights[3] - heights[2];
+            slopeY = heights[2] - heights[0];
+        }
+        else
+        {
+            // South-east, north-east, north-west
+            slopeX = heights[1] - heights[0];
+            slopeY = heights[3] - heights[1];
+        }
+    }
+
+    float leafHeight(const Leaf &leaf, float x, float y)
+    {
+        float heights[4];
+        cornerHeights(leaf, heights);
+        float fx = (x - leaf.x) / leaf.sizeX;
+        float fy = (leaf.y - y) / leaf.sizeY;
+        float slopeX, slopeY;
+        triangleSlopes(heights, fx, fy, slopeX, slopeY);
+        return heights[0] + slopeX * fx + slopeY * fy;
+    }
+
+    // Below this many rays a batch isn't worth a thread
+    const int raysPerTask = 64;
+    // Heights of the min/max levels and of the cells round differently, boxes are padded
+    const float boxPadding = 1e-4f;
+
+    // Ray in cell units : x east and y south from the north-west sample, z the height
+    struct GridRay
+    {
+        float origin[3];
+        float direction[3];
+    };
+
+    GridRay toGrid(const Ray &ray)
+    {
+        const float cellsX = static_cast<float>(GeometryEngine::heightField.width() - 1);
+        const float cellsY = static_cast<float>(GeometryEngine::heightField.height() - 1);
+        GridRay grid = { { (ray.origin.x() - QuadNode::startx) / QuadNode::width * cellsX,
+                           (QuadNode::starty - ray.origin.y()) / QuadNode::height * cellsY,
+                           ray.origin.z() },
+                         { ray.direction.x() / QuadNode::width * cellsX,
+                           -ray.direction.y() / QuadNode::height * cellsY,
+                           ray.direction.z() } };
+        return grid;
+    }
+
+    // Clips [tNear, tFar] to the box, false if nothing is left
+    bool clipToBox(const GridRay &ray, const float low[3], const float high[3], float &tNear, float &tFar)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float o = ray.origin[axis];
+            float d = ray.direction[axis];
+            if (d == 0.f)
+            {
+                if (o < low[axis] || o > high[axis])
+                    return false;
+                continue;
+            }
+            float t0 = (low[axis] - o) / d;
+            float t1 = (high[axis] - o) / d;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tNear = std::max(tNear, t0);
+            tFar = std::min(tFar, t1);
+            if (tNear > tFar)
+                return false;
+        }
+        return true;
+    }
+
+    // First t in [tNear, tFar] where the ray meets the bilinear patch of cell (x, y)
+    bool intersectCell(const GridRay &ray, int x, int y, float tNear, float tFar, float &t)
+    {
+        const auto &heights = GeometryEngine::heightField;
+        // h(u, v) = a + b u + c v + d u v over the cell
+        double a = heights.at(x, y);
+        double b = heights.at(x + 1, y) - a;
+        double c = heights.at(x, y + 1) - a;
+        double d = heights.at(x + 1, y + 1) - heights.at(x + 1, y) - heights.at(x, y + 1) + a;
+        double u0 = ray.origin[0] - x, du = ray.direction[0];
+        double v0 = ray.origin[1] - y, dv = ray.direction[1];
+        // Ray height minus surface height along the ray : A t^2 + B t + C
+        double A = -d * du * dv;
+        double B = ray.direction[2] - (b * du + c * dv + d * (u0 * dv + v0 * du));
+        double C = ray.origin[2] - (a + b * u0 + c * v0 + d * u0 * v0);
+
+        // Already under the surface where it enters the cell
+        if ((A * tNear + B) * tNear + C <= 0.)
+        {
+            t = tNear;
+            return true;
+        }
+        double roots[2];
+        int count = 0;
+        if (std::abs(A) < 1e-12)
+        {
+            if (B != 0.)
+                roots[count++] = -C / B;
+        }
+        else
+        {
+            double discriminant = B * B - 4. * A * C;
+            if (discriminant < 0.)
+                return false;
+            // Without the cancellation of -B + sqrt(discriminant)
+            double q = -.5 * (B + std::copysign(std::sqrt(discriminant), B));
+            roots[count++] = q / A;
+            if (q != 0.)
+                roots[count++] = C / q;
+        }
+        bool found = false;
+        for (int i = 0; i < count; i++)
+            if (roots[i] >= tNear && roots[i] <= tFar && (!found || roots[i] < t))
+            {
+                t = static_cast<float>(roots[i]);
+                found = true;
+            }
+        return found;
+    }
+
+    // u, v of the heightmap, from the north-west corner
+    float toU(float x)
+    {
+        return (x - QuadNode::startx) / QuadNode::width;
+    }
+
+    float toV(float y)
+    {
+        return (QuadNode::starty - y) / QuadNode::height;
+    }
+
+    // Reference for intersect() : steps of an eighth of a cell along the ray, then bisection
+    // of the step where it went under the surface. Misses crossings thinner than a step
+    RayHit marchRay(const Ray &ray, float cell, float bottom)
+    {
+        RayHit result;
+        float along = std::max(std::hypot(ray.direction.x(), ray.direction.y()), std::abs(ray.direction.z()));
+        if (along <= 0.f)
+            return result;
+        const float step = cell / 8.f / along;
+        auto above = [&](float t)
+        {
+            QVector3D p = ray.origin + ray.direction * t;
+            return p.z() - TerrainQuery::detailHeightAt(p.x(), p.y());
+        };
+        float previous = 0.f;
+        for (float t = 0.f; ; t += step)
+        {
+            QVector3D p = ray.origin + ray.direction * t;
+            if (!TerrainQuery::contains(p.x(), p.y()) || p.z() < bottom)
+                return result;
+            if (above(t) <= 0.f)
+            {
+                float low = previous;
+                float high = t;
+                for (int i = 0; i < 40; i++)
+                {
+                    float middle = .5f * (low + high);
+                    if (above(middle) <= 0.f)
+                        high = middle;
+                    else
+                        low = middle;
+                }
+                result.hit = true;
+                result.t = high;
+                result.position = ray.origin + ray.direction * high;
+                return result;
+            }
+            previous = t;
+        }
+    }
+}
+
+bool TerrainQuery::isReady()
+{
+    return !GeometryEngine::heightField.isNull() && !GeometryEngine::heightPyramid.isNull();
+}
+
+bool TerrainQuery::contains(float x, float y)
+{
+    return x >= QuadNode::startx && x <= QuadNode::startx + QuadNode::width
+        && y >= QuadNode::starty - QuadNode::height && y <= QuadNode::starty;
+}
+
+float TerrainQuery::heightAt(float x, float y)
+{
+    x = clampX(x);
+    y = clampY(y);
+    return leafHeight(leafAt(x, y), x, y);
+}
+
+QVector3D TerrainQuery::normalAt(float x, float y)
+{
+    x = clampX(x);
+    y = clampY(y);
+    Leaf leaf = leafAt(x, y);
+    float heights[4];
+    cornerHeights(leaf, heights);
+    float slopeX, slopeY;
+    triangleSlopes(heights, (x - leaf.x) / leaf.sizeX, (leaf.y - y) / leaf.sizeY, slopeX, slopeY);
+    // fy grows southward while y grows northward
+    return QVector3D(-slopeX / leaf.sizeX, slopeY / leaf.sizeY, 1.f).normalized();
+}
+
+void TerrainQuery::heightsAt(const float *x, const float *y, float *heights, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 minX = _mm_set1_ps(QuadNode::startx);
+    const __m128 maxX = _mm_set1_ps(QuadNode::startx + QuadNode::width);
+    const __m128 minY = _mm_set1_ps(QuadNode::starty - QuadNode::height);
+    const __m128 maxY = _mm_set1_ps(QuadNode::starty);
+    const __m128 maxDist = _mm_set1_ps(QuadNode::maxDist);
+    const __m128 half = _mm_set1_ps(.5f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 px = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x + i), minX), maxX);
+        __m128 py = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(y + i), minY), maxY);
+        // The lanes may fall in chunks built around different focus points
+        alignas(16) float lanes[6][4];
+        _mm_store_ps(lanes[0], px);
+        _mm_store_ps(lanes[1], py);
+        QVector3D foci[4];
+        alignas(16) float fociX[4], fociY[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            foci[lane] = GeometryEngine::drawnFocus(lanes[0][lane], lanes[1][lane]);
+            fociX[lane] = foci[lane].x();
+            fociY[lane] = foci[lane].y();
+        }
+        const __m128 focusX = _mm_load_ps(fociX);
+        const __m128 focusY = _mm_load_ps(fociY);
+        __m128 nodeX = minX;
+        __m128 nodeY = maxY;
+        __m128 sizeX = _mm_set1_ps(QuadNode::width);
+        __m128 sizeY = _mm_set1_ps(QuadNode::height);
+        // Lanes still splitting, the others keep their leaf
+        __m128 splitting = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int depth = QuadNode::startDepth - 1; depth >= 0 && _mm_movemask_ps(splitting) != 0; depth--)
+        {
+            sizeX = _mm_or_ps(_mm_and_ps(splitting, _mm_mul_ps(sizeX, half)), _mm_andnot_ps(splitting, sizeX));
+            sizeY = _mm_or_ps(_mm_and_ps(splitting, _mm_mul_ps(sizeY, half)), _mm_andnot_ps(splitting, sizeY));
+            __m128 east = _mm_and_ps(splitting, _mm_cmpge_ps(px, _mm_add_ps(nodeX, sizeX)));
+            __m128 south = _mm_and_ps(splitting, _mm_cmple_ps(py, _mm_sub_ps(nodeY, sizeY)));
+            nodeX = _mm_add_ps(nodeX, _mm_and_ps(east, sizeX));
+            nodeY = _mm_sub_ps(nodeY, _mm_and_ps(south, sizeY));
+
+            if (QuadNode::startDepth - depth < QuadNode::minDepth)
+                continue;
+            // distance() : squared distance from the focus point to the node, over maxDist
+            __m128 nearX = _mm_min_ps(_mm_max_ps(focusX, nodeX), _mm_add_ps(nodeX, sizeX));
+            __m128 nearY = _mm_min_ps(_mm_max_ps(focusY, _mm_sub_ps(nodeY, sizeY)), nodeY);
+            __m128 dx = _mm_sub_ps(nearX, focusX);
+            __m128 dy = _mm_sub_ps(nearY, focusY);
+            __m128 dist = _mm_div_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), maxDist);
+            splitting = _mm_and_ps(splitting, _mm_cmpgt_ps(_mm_set1_ps(static_cast<float>(depth)), dist));
+        }
+
+        // Corner lookups differ per leaf : one lane at a time
+        _mm_store_ps(lanes[2], nodeX);
+        _mm_store_ps(lanes[3], nodeY);
+        _mm_store_ps(lanes[4], sizeX);
+        _mm_store_ps(lanes[5], sizeY);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            Leaf leaf = { lanes[2][lane], lanes[3][lane], lanes[4][lane], lanes[5][lane], foci[lane] };
+            heights[i + lane] = leafHeight(leaf, lanes[0][lane], lanes[1][lane]);
+        }
+    }
+#endif
+    for (; i < count; i++)
+        heights[i] = heightAt(x[i], y[i]);
+}
+
+float TerrainQuery::detailHeightAt(float x, float y)
+{
+    return GeometryEngine::heightField.bilinear(toU(x), toV(y));
+}
+
+QVector3D TerrainQuery::detailNormalAt(float x, float y)
+{
+    // Normals share the layout of the heights, and so their taps
+    BilinearTaps taps = GeometryEngine::heightField.bilinearTaps(toU(x), toV(y));
+    const SampleStore<QVector3D> &normals = GeometryEngine::normalMap;
+    QVector3D top = normals[taps.offsets[0]] + (normals[taps.offsets[1]] - normals[taps.offsets[0]]) * taps.tx;
+    QVector3D bottom = normals[taps.offsets[2]] + (normals[taps.offsets[3]] - normals[taps.offsets[2]]) * taps.tx;
+    return (top + (bottom - top) * taps.ty).normalized();
+}
+
+RayHit TerrainQuery::intersect(const Ray &ray)
+{
+    RayHit result;
+    const MinMaxPyramid &ranges = GeometryEngine::heightRanges;
+    if (ranges.isNull())
+        return result;
+    const GridRay grid = toGrid(ray);
+    const int cellsX = ranges.cellsWide();
+    const int cellsY = ranges.cellsHigh();
+    const int tile = MinMaxPyramid::tileCells;
+    float best = std::numeric_limits<float>::max();
+
+    struct Node
+    {
+        int level;
+        int x;
+        int y;
+        float tNear;
+        float tFar;
+    };
+    // Box of node (x, y) of a level : the cells it covers, between its lowest and highest height
+    auto clip = [&](int level, int x, int y, float &tNear, float &tFar)
+    {
+        const HeightRange &range = ranges.level(level).at(x, y);
+        const float low[3] = { static_cast<float>((x * tile) << level), static_cast<float>((y * tile) << level),
+                               range.min - boxPadding };
+        const float high[3] = { static_cast<float>(std::min(((x + 1) * tile) << level, cellsX)),
+                                static_cast<float>(std::min(((y + 1) * tile) << level, cellsY)),
+                                range.max + boxPadding };
+        tNear = 0.f;
+        tFar = best;
+        return clipToBox(grid, low, high, tNear, tFar);
+    };
+    // Cells of a tile the ray crosses, within the height range of the tile
+    auto intersectTile = [&](int tx, int ty)
+    {
+        const HeightRange &range = ranges.level(0).at(tx, ty);
+        for (int y = ty * tile; y < std::min((ty + 1) * tile, cellsY); y++)
+            for (int x = tx * tile; x < std::min((tx + 1) * tile, cellsX); x++)
+            {
+                const float low[3] = { static_cast<float>(x), static_cast<float>(y), range.min - boxPadding };
+                const float high[3] = { static_cast<float>(x + 1), static_cast<float>(y + 1), range.max + boxPadding };
+                float tNear = 0.f, tFar = best, t;
+                if (clipToBox(grid, low, high, tNear, tFar) && intersectCell(grid, x, y, tNear, tFar, t))
+                    best = std::min(best, t);
+            }
+    };
+
+    std::vector<Node> stack;
+    stack.reserve(static_cast<size_t>(4 * ranges.levelCount()));
+    Node root = { ranges.levelCount() - 1, 0, 0, 0.f, 0.f };
+    if (clip(root.level, 0, 0, root.tNear, root.tFar))
+        stack.push_back(root);
+    while (!stack.empty())
+    {
+        Node node = stack.back();
+        stack.pop_back();
+        // A nearer hit was found since the node was pushed
+        if (node.tNear >= best)
+            continue;
+        if (node.level == 0)
+        {
+            intersectTile(node.x, node.y);
+            continue;
+        }
+
+        // Children the ray crosses, pushed farthest first so the nearest is popped next
+        const MinMaxPyramid::Level &below = ranges.level(node.level - 1);
+        Node children[4];
+        int count = 0;
+        for (int dy = 0; dy < 2; dy++)
+            for (int dx = 0; dx < 2; dx++)
+            {
+                Node child = { node.level - 1, 2 * node.x + dx, 2 * node.y + dy, 0.f, 0.f };
+                if (child.x < below.width && child.y < below.height && clip(child.level, child.x, child.y, child.tNear, child.tFar))
+                    children[count++] = child;
+            }
+        std::sort(children, children + count, [](const Node &a, const Node &b) { return a.tNear > b.tNear; });
+        stack.insert(stack.end(), children, children + count);
+    }
+
+    if (best < std::numeric_limits<float>::max())
+    {
+        result.hit = true;
+        result.t = best;
+        result.position = ray.origin + ray.direction * best;
+    }
+    return result;
+}
+
+void TerrainQuery::intersect(const Ray *rays, RayHit *hits, int count)
+{
+    auto cast = [rays, hits](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+            hits[i] = intersect(rays[i]);
+    };
+    // Bands of rays on the pool threads, the last one on ours
+    int tasks = std::min(static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)),
+                         std::max(count / raysPerTask, 1));
+    int size = (count + tasks - 1) / std::max(tasks, 1);
+    std::vector<std::future<void>> bands;
+    for (int first = 0; first < count; first += size)
+    {
+        int last = std::min(first + size, count);
+        if (last == count)
+            cast(first, last);
+        else
+            bands.push_back(std::async(std::launch::async, cast, first, last));
+    }
+    for (std::future<void> &band : bands)
+        band.wait();
+}
+
+void TerrainQuery::benchmark(int count)
+{
+    if (!GeometryEngine::loadHeightMap())
+        return;
+    count = std::max(count, 1);
+    const MinMaxPyramid &ranges = GeometryEngine::heightRanges;
+    const HeightRange &whole = ranges.level(ranges.levelCount() - 1).at(0, 0);
+    const float cell = std::min(QuadNode::width / (GeometryEngine::heightField.width() - 1),
+                                QuadNode::height / (GeometryEngine::heightField.height() - 1));
+
+    // From above the highest point, down at every slope from grazing to vertical
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::vector<Ray> rays(static_cast<size_t>(count));
+    for (Ray &ray : rays)
+    {
+        float angle = 6.2831853f * unit(random);
+        ray.origin = QVector3D(QuadNode::startx + QuadNode::width * unit(random), QuadNode::starty - QuadNode::height * unit(random),
+                               whole.max + (whole.max - whole.min) * unit(random) + .01f);
+        ray.direction = QVector3D(std::cos(angle), std::sin(angle), -(.02f + unit(random)));
+    }
+
+    std::vector<RayHit> hits(rays.size());
+    int64_t start = Profiler::now();
+    for (size_t i = 0; i < rays.size(); i++)
+        hits[i] = intersect(rays[i]);
+    int64_t pyramid = Profiler::now() - start;
+
+    std::vector<RayHit> marched(rays.size());
+    start = Profiler::now();
+    for (size_t i = 0; i < rays.size(); i++)
+        marched[i] = marchRay(rays[i], cell, whole.min);
+    int64_t march = Profiler::now() - start;
+
+    // The march steps over the crossings thinner than its step, so it finds a later hit or
+    // none. An earlier hit or a hit point off the surface is a fault of intersect()
+    int found = 0;
+    int missed = 0;
+    int offSurface = 0;
+    int grazes = 0;
+    float worst = 0.f;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        const RayHit &hit = hits[i];
+        const RayHit &reference = marched[i];
+        if (hit.hit)
+        {
+            found++;
+            offSurface += std::abs(hit.position.z() - detailHeightAt(hit.position.x(), hit.position.y())) > 1e-3f ? 1 : 0;
+        }
+        float error = hit.hit && reference.hit ? (hit.position - reference.position).length() / cell : 0.f;
+        if (reference.hit && (!hit.hit || (error > .125f && reference.t < hit.t)))
+            missed++;
+        else if (hit.hit && (!reference.hit || error > .125f))
+            grazes++;
+        else
+            worst = std::max(worst, error);
+    }
+
+    std::cout << "pick " << count << " rays, " << found << " hits : pyramid " << pyramid / 1e6 << " ms, march "
+              << march / 1e6 << " ms" << std::endl;
+    std::cout << "missed by the pyramid " << missed << ", off the surface " << offSurface << ", grazes stepped over by the march "
+              << grazes << ", worst agreement " << worst << " cells" << std::endl;
+}
@@ -0,0 +1,58 @@
+#ifndef TERRAINQUERY_H
+#define TERRAINQUERY_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+// Half line from origin, direction need not be normalized
+struct Ray
+{
+    QVector3D origin;
+    QVector3D direction;
+
+    // Same ray in the space matrix maps to
+    Ray mapped(const QMatrix4x4 &matrix) const { return { matrix.map(origin), matrix.mapVector(direction) }; }
+};
+
+struct RayHit
+{
+    bool hit = false;
+    float t = 0.f;          // position = origin + t * direction
+    QVector3D position;
+};
+
+// Ground under points of the terrain plane : x, y in QuadNode coordinates, heights along z.
+// heightAt() and normalAt() follow the surface as drawn, the triangle of the leaf holding the
+// point in the chunk around it, split around the focus point that chunk was built for. Found
+// without building the tree : startDepth steps per point whatever the size of the heightmap.
+// Points outside the terrain get its nearest border
+namespace TerrainQuery
+{
+    // The heights are decoded
+    bool isReady();
+    // (x, y) lies over the terrain
+    bool contains(float x, float y);
+
+    float heightAt(float x, float y);
+    QVector3D normalAt(float x, float y);
+    // heightAt() of count points, the leaves of four points at a time are found with SSE2
+    void heightsAt(const float *x, const float *y, float *heights, int count);
+
+    // Full resolution heightmap and normals, bilinear, whatever the level of detail
+    float detailHeightAt(float x, float y);
+    QVector3D detailNormalAt(float x, float y);
+
+    // First crossing of the full resolution surface by a ray given in terrain coordinates.
+    // Descends the min/max pyramid nearest node first, skipping the nodes the ray passes
+    // above or below, and solves the bilinear patch of the cells it reaches
+    RayHit intersect(const Ray &ray);
+    // intersect() of count rays, split between the cores for large batches
+    void intersect(const Ray *rays, RayHit *hits, int count);
+
+    // Casts count random rays down at the heightmap with intersect() and with a ray march of
+    // an eighth of a cell refined by bisection, then prints their disagreements and timings.
+    // Run with tp3 --bench-pick <rays>
+    void benchmark(int count);
+}
+
+#endif // TERRAINQUERY_H
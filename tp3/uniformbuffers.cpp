@@ -0,0 +1,128 @@
+#include "uniformbuffers.h"
+
+#include <QOpenGLContext>
+#include <cstring>
+
+FrameUniformBuffer *FrameUniformBuffer::shared = nullptr;
+int FrameUniformBuffer::users = 0;
+
+FrameUniformBuffer::FrameUniformBuffer()
+    : buffer(0), uploaded(false), revision(0)
+{
+    QOpenGLFunctions *gl = functions();
+    gl->glGenBuffers(1, &buffer);
+    gl->glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    gl->glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+FrameUniformBuffer::~FrameUniformBuffer()
+{
+    functions()->glDeleteBuffers(1, &buffer);
+}
+
+QOpenGLFunctions *FrameUniformBuffer::functions()
+{
+    return QOpenGLContext::currentContext()->functions();
+}
+
+FrameUniformBuffer *FrameUniformBuffer::acquire()
+{
+    if (shared == nullptr)
+        shared = new FrameUniformBuffer;
+    users++;
+    return shared;
+}
+
+void FrameUniformBuffer::release()
+{
+    // The last user must have a context of the share group current
+    if (--users == 0)
+    {
+        delete shared;
+        shared = nullptr;
+    }
+}
+
+void FrameUniformBuffer::update(Camera &camera, GLStateCache &state)
+{
+    if (uploaded && camera.getRevision() == revision)
+        return;
+
+    FrameUniforms data;
+    std::memcpy(data.v_matrix, camera.getViewMatrix().constData(), sizeof(data.v_matrix));
+    QVector3D position = camera.getPosition();
+    data.camera_position[0] = position.x();
+    data.camera_position[1] = position.y();
+    data.camera_position[2] = position.z();
+    data.camera_position[3] = 1.f;
+
+    state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    functions()->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+    uploaded = true;
+    revision = camera.getRevision();
+}
+
+void FrameUniformBuffer::bind(GLStateCache &state)
+{
+    state.bindBufferBase(FrameBinding, buffer);
+}
+
+ViewUniformBuffer::ViewUniformBuffer(QOpenGLFunctions_4_5_Core *gl, int slotCount)
+    : gl(gl), buffer(0), cache(static_cast<size_t>(slotCount)), valid(static_cast<size_t>(slotCount), false), uploadCount(0)
+{
+    // Each slot must start on the implementation's offset alignment
+    GLint alignment = 256;
+    gl->glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = ((static_cast<GLintptr>(sizeof(ViewUniforms)) + alignment - 1) / alignment) * alignment;
+
+    gl->glGenBuffers(1, &buffer);
+    gl->glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    gl->glBufferData(GL_UNIFORM_BUFFER, stride * slotCount, nullptr, GL_DYNAMIC_DRAW);
+    gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+ViewUniformBuffer::~ViewUniformBuffer()
+{
+    gl->glDeleteBuffers(1, &buffer);
+}
+
+void ViewUniformBuffer::set(GLStateCache &state, int slot, const QMatrix4x4 &model, const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector4D &color)
+{
+    ViewUniforms data;
+    std::memcpy(data.m_matrix, model.constData(), sizeof(data.m_matrix));
+    std::memcpy(data.p_matrix, projection.constData(), sizeof(data.p_matrix));
+    QMatrix4x4 mvp = projection * view * model;
+    std::memcpy(data.mvp_matrix, mvp.constData(), sizeof(data.mvp_matrix));
+    data.a_color[0] = color.x();
+    data.a_color[1] = color.y();
+    data.a_color[2] = color.z();
+    data.a_color[3] = color.w();
+
+    size_t i = static_cast<size_t>(slot);
+    if (!valid[i] || std::memcmp(&cache[i], &data, sizeof(data)) != 0)
+    {
+        state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        gl->glBufferSubData(GL_UNIFORM_BUFFER, stride * slot, sizeof(data), &data);
+        cache[i] = data;
+        valid[i] = true;
+        uploadCount++;
+    }
+    state.bindBufferRange(ViewBinding, buffer, stride * slot, sizeof(ViewUniforms));
+}
+
+int ViewUniformBuffer::uploads() const
+{
+    return uploadCount;
+}
+
+void bindUniformBlocks(QOpenGLFunctions_4_5_Core *gl, GLuint program)
+{
+    GLuint frame = gl->glGetUniformBlockIndex(program, "FrameData");
+    if (frame != GL_INVALID_INDEX)
+        gl->glUniformBlockBinding(program, frame, FrameBinding);
+
+    GLuint view = gl->glGetUniformBlockIndex(program, "ViewData");
+    if (view != GL_INVALID_INDEX)
+        gl->glUniformBlockBinding(program, view, ViewBinding);
+}
@@ -0,0 +1,81 @@
+#ifndef UNIFORMBUFFERS_H
+#define UNIFORMBUFFERS_H
+
+#include "camera.h"
+#include "glstatecache.h"
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include <vector>
+
+// Binding points of the uniform blocks declared in vshader.glsl
+enum UniformBinding { FrameBinding = 0, ViewBinding = 1 };
+
+// std140 layout of the FrameData block
+struct FrameUniforms
+{
+    float v_matrix[16];
+    float camera_position[4];
+};
+
+// std140 layout of the ViewData block
+struct ViewUniforms
+{
+    float m_matrix[16];
+    float p_matrix[16];
+    float mvp_matrix[16];   // p * v * m, for the PRECOMBINED_MVP variants
+    float a_color[4];
+};
+
+// Per-frame camera data, one buffer for every program and window of the share group.
+// It outlives the widget that created it : calls go through the current context
+class FrameUniformBuffer
+{
+public:
+    static FrameUniformBuffer *acquire();
+    static void release();
+
+    // Uploads only when the camera moved since the last upload
+    void update(Camera &camera, GLStateCache &state);
+    // Binding points are per context, every widget binds it once per frame
+    void bind(GLStateCache &state);
+
+private:
+    FrameUniformBuffer();
+    ~FrameUniformBuffer();
+
+    static QOpenGLFunctions *functions();
+
+    static FrameUniformBuffer *shared;
+    static int users;
+    GLuint buffer;
+    bool uploaded;
+    unsigned int revision;
+};
+
+// Per-view data (model, projection, season colour), one aligned slot per viewport
+class ViewUniformBuffer
+{
+public:
+    ViewUniformBuffer(QOpenGLFunctions_4_5_Core *gl, int slotCount);
+    ~ViewUniformBuffer();
+
+    // Uploads the slot only if its content changed, then binds it
+    void set(GLStateCache &state, int slot, const QMatrix4x4 &model, const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector4D &color);
+    int uploads() const;
+
+private:
+    QOpenGLFunctions_4_5_Core *gl;
+    GLuint buffer;
+    GLintptr stride;
+    std::vector<ViewUniforms> cache;
+    std::vector<bool> valid;
+    int uploadCount;
+};
+
+// Ties the blocks of a freshly linked program to the binding points above
+void bindUniformBlocks(QOpenGLFunctions_4_5_Core *gl, GLuint program);
+
+#endif // UNIFORMBUFFERS_H
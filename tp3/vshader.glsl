@@ -1,30 +1,76 @@
-#ifdef GL_ES
-// Set default precision to medium
-precision mediump int;
-precision mediump float;
-#endif
+#version 330
+
+// Variants are specialised by ShaderLibrary, which inserts the feature #defines here :
+// TEXTURED, PRECOMBINED_MVP, GPU_DISPLACEMENT, PACKED_VERTICES, WIREFRAME, WIRE_FILL
+
+// Shared by every view, uploaded once per camera move (binding 0)
+layout(std140) uniform FrameData
+{
+    mat4 v_matrix;
+    vec4 camera_position;
+};
 
-uniform mat4 m_matrix;
-uniform mat4 v_matrix;
-uniform mat4 p_matrix;
+// One slot per view or viewport (binding 1)
+layout(std140) uniform ViewData
+{
+    mat4 m_matrix;
+    mat4 p_matrix;
+    mat4 mvp_matrix;
+    vec4 a_color;
+};
+
+// Terrain origin (x, y) and size (width, height), then height scale and bias
+uniform vec4 u_terrain;
+uniform vec2 u_height;
 
-uniform vec4 a_color;
+#ifdef GPU_DISPLACEMENT
+uniform sampler2D u_heightmap;
+#endif
 
-attribute vec4 a_position;
-attribute vec2 a_texcoord;
+in vec4 a_position;
+in vec2 a_texcoord;
 
-varying vec2 v_texcoord;
-varying vec4 v_color;
+// The geometry shader sits between the two stages in the WIREFRAME variants
+#ifdef WIREFRAME
+#define v_texcoord g_texcoord
+#define v_color g_color
+#endif
+
+#ifdef TEXTURED
+out vec2 v_texcoord;
+#endif
+out vec4 v_color;
 
 //! [0]
 void main()
 {
+    vec4 position = a_position;
+#ifdef PACKED_VERTICES
+    // Normalized 16 bit coordinates span the terrain bounds
+    position.xyz = vec3(u_terrain.x + a_position.x * u_terrain.z,
+                        u_terrain.y - a_position.y * u_terrain.w,
+                        a_position.z * u_height.x + u_height.y);
+#endif
+#ifdef GPU_DISPLACEMENT
+    // Same nearest texel as QuadNode::iteration() on the CPU
+    ivec2 size = textureSize(u_heightmap, 0);
+    vec2 uv = vec2(position.x - u_terrain.x, u_terrain.y - position.y) / u_terrain.zw;
+    ivec2 texel = clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);
+    position.z = texelFetch(u_heightmap, texel, 0).r * u_height.x + u_height.y;
+#endif
+
     // Calculate vertex position in screen space
-    gl_Position = p_matrix * v_matrix * m_matrix * a_position;
+#ifdef PRECOMBINED_MVP
+    gl_Position = mvp_matrix * position;
+#else
+    gl_Position = p_matrix * v_matrix * m_matrix * position;
+#endif
 
+#ifdef TEXTURED
     // Pass texture coordinate to fragment shader
     // Value will be automatically interpolated to fragments inside polygon faces
     v_texcoord = a_texcoord;
+#endif
     v_color = a_color;
 }
 //! [0]